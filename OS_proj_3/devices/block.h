@@ -2,7 +2,10 @@
 #define DEVICES_BLOCK_H
 
 #include <stddef.h>
+#include <stdbool.h>
 #include <inttypes.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +56,46 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* An asynchronous transfer of CNT consecutive sectors starting
+   at SECTOR between a block device and BUFFER, which must be in
+   kernel memory.
+
+   The submitter fills in the first group of members with
+   block_request_init(), optionally sets COMPLETE and AUX, and
+   passes the request to block_submit().  The block layer owns
+   the request until it completes.  Then, if COMPLETE is
+   non-null, it is called from the device's dispatcher thread,
+   which must not be blocked for long; otherwise block_wait()
+   returns. */
+struct block_request
+  {
+    bool write;                 /* Write, not read? */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    void (*complete) (struct block_request *);  /* Completion hook. */
+    void *aux;                  /* For COMPLETE's use. */
+
+    /* Owned by the block layer. */
+    struct list_elem queue_elem;        /* In device's queue. */
+    struct list_elem deadline_elem;     /* In device's deadline list. */
+    int64_t deadline;                   /* Dispatch by this tick. */
+    uint64_t submit_tsc;                /* TSC at submission. */
+    struct semaphore done;              /* Up'd on completion. */
+  };
+
+void block_request_init (struct block_request *, bool write,
+                         block_sector_t, size_t cnt, void *buffer);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,6 +105,13 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors at once.  If
+       null, the block layer transfers them one at a time. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
@@ -0,0 +1,71 @@
+#include "devices/pci.h"
+#include "threads/io.h"
+
+/* PCI configuration space access ports.  See [PCI] for details.
+   Pintos only looks at bus 0, which is where QEMU and Bochs put
+   all of their devices. */
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Selects configuration register REG of function FUNC of device
+   DEV on bus BUS for the next access to PCI_CONFIG_DATA. */
+static void
+select_config (int bus, int dev, int func, int reg) 
+{
+  outl (PCI_CONFIG_ADDR, 0x80000000 | (bus << 16) | (dev << 11)
+                         | (func << 8) | (reg & 0xfc));
+}
+
+/* Returns configuration register REG of function FUNC of device
+   DEV on bus BUS. */
+uint32_t
+pci_read_config (int bus, int dev, int func, int reg) 
+{
+  select_config (bus, dev, func, reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Sets configuration register REG of function FUNC of device DEV
+   on bus BUS to VALUE. */
+void
+pci_write_config (int bus, int dev, int func, int reg, uint32_t value) 
+{
+  select_config (bus, dev, func, reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Turns on I/O space access and bus mastering for function FUNC
+   of device DEV on bus BUS. */
+void
+pci_enable (int bus, int dev, int func) 
+{
+  uint32_t command = pci_read_config (bus, dev, func, PCI_REG_COMMAND);
+  pci_write_config (bus, dev, func, PCI_REG_COMMAND,
+                    command | PCI_CMD_IO | PCI_CMD_MASTER);
+}
+
+/* Calls FOUND for each function present on PCI bus 0, passing
+   AUX along, until FOUND returns true. */
+void
+pci_scan (pci_scan_func *found, void *aux) 
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t id = pci_read_config (0, dev, func, PCI_REG_ID);
+
+        if ((id & 0xffff) == 0xffff)
+          {
+            /* No such function, and no others if function 0 is
+               missing. */
+            if (func == 0)
+              break;
+            continue;
+          }
+        if (found (0, dev, func, id,
+                   pci_read_config (0, dev, func, PCI_REG_CLASS), aux))
+          return;
+      }
+}
@@ -0,0 +1,87 @@
+#include "devices/ramdisk.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device kept in memory, for taking the disk out of
+   file system measurements and for scratch space that needs no
+   disk image.  It is registered as a raw device named "rd0", so
+   it only takes on a role when named by -filesys, -scratch or
+   -swap.  Its contents are lost at power off. */
+
+/* Sectors per page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+static struct block_operations ramdisk_operations;
+
+/* Creates a RAM disk of SECTORS sectors, rounded up to a whole
+   number of pages, and registers it.  The memory comes from the
+   kernel pool if it has enough contiguous pages, otherwise from
+   the user pool.  Panics if neither does. */
+void
+ramdisk_init (size_t sectors) 
+{
+  size_t page_cnt = DIV_ROUND_UP (sectors, SECTORS_PER_PAGE);
+  uint8_t *data;
+
+  if (page_cnt == 0)
+    return;
+  data = palloc_get_multiple (PAL_ZERO, page_cnt);
+  if (data == NULL)
+    data = palloc_get_multiple (PAL_ZERO | PAL_USER, page_cnt);
+  if (data == NULL)
+    PANIC ("rd0: can't allocate %zu pages (try a larger -m)", page_cnt);
+
+  block_register ("rd0", BLOCK_RAW, "RAM disk", page_cnt * SECTORS_PER_PAGE,
+                  &ramdisk_operations, data);
+}
+
+/* Reads sector SEC_NO from RAM disk DATA_ into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *data_, block_sector_t sec_no, void *buffer) 
+{
+  uint8_t *data = data_;
+  memcpy (buffer, data + sec_no * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SEC_NO of RAM disk DATA_ from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *data_, block_sector_t sec_no, const void *buffer) 
+{
+  uint8_t *data = data_;
+  memcpy (data + sec_no * BLOCK_SECTOR_SIZE, buffer, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads CNT sectors starting at SEC_NO from RAM disk DATA_ into
+   BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+ramdisk_read_multiple (void *data_, block_sector_t sec_no, size_t cnt,
+                       void *buffer) 
+{
+  uint8_t *data = data_;
+  memcpy (buffer, data + sec_no * BLOCK_SECTOR_SIZE, cnt * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes CNT sectors starting at SEC_NO of RAM disk DATA_ from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write_multiple (void *data_, block_sector_t sec_no, size_t cnt,
+                        const void *buffer) 
+{
+  uint8_t *data = data_;
+  memcpy (data + sec_no * BLOCK_SECTOR_SIZE, buffer, cnt * BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    ramdisk_read_multiple,
+    ramdisk_write_multiple
+  };
@@ -0,0 +1,100 @@
+/* Measures how well paging and file I/O overlap.  Times a file
+   copy on its own, the 4 child-linear processes of page-parallel
+   on their own, and then both at once, and prints the cost of
+   each in TSC cycles.  Swap and the file system sit on disks on
+   different IDE channels, so the combined run should take less
+   than the two runs apart. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHILD_CNT 4
+#define CHUNK_SIZE 4096
+#define COPY_SIZE (128 * 1024)
+
+static char buf[CHUNK_SIZE];
+
+/* Returns the CPU's time-stamp counter, which user programs may
+   read. */
+static inline unsigned long long
+rdtsc (void)
+{
+  unsigned long long tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Waits for the child-linear processes CHILDREN. */
+static void
+wait_linear (pid_t children[])
+{
+  int i;
+
+  for (i = 0; i < CHILD_CNT; i++)
+    CHECK (wait (children[i]) == 0x42, "wait for child %d", i);
+}
+
+/* Copies "copy-src" to a new "copy-dst" in CHUNK_SIZE pieces. */
+static void
+copy_file (void)
+{
+  int src, dst;
+  size_t ofs;
+
+  CHECK (create ("copy-dst", COPY_SIZE), "create \"copy-dst\"");
+  CHECK ((src = open ("copy-src")) > 1, "open \"copy-src\"");
+  CHECK ((dst = open ("copy-dst")) > 1, "open \"copy-dst\"");
+  for (ofs = 0; ofs < COPY_SIZE; ofs += CHUNK_SIZE)
+    {
+      if (read (src, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read \"copy-src\" at offset %zu", ofs);
+      if (write (dst, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write \"copy-dst\" at offset %zu", ofs);
+    }
+  msg ("close \"copy-src\"");
+  close (src);
+  msg ("close \"copy-dst\"");
+  close (dst);
+  CHECK (remove ("copy-dst"), "remove \"copy-dst\"");
+}
+
+void
+test_main (void)
+{
+  pid_t children[CHILD_CNT];
+  unsigned long long start, copy, paging, both;
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("copy-src", COPY_SIZE), "create \"copy-src\"");
+  CHECK ((fd = open ("copy-src")) > 1, "open \"copy-src\"");
+  memset (buf, 0x5a, sizeof buf);
+  for (ofs = 0; ofs < COPY_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write \"copy-src\" at offset %zu", ofs);
+  msg ("close \"copy-src\"");
+  close (fd);
+
+  start = rdtsc ();
+  copy_file ();
+  copy = rdtsc () - start;
+
+  start = rdtsc ();
+  exec_children ("child-linear", children, CHILD_CNT);
+  wait_linear (children);
+  paging = rdtsc () - start;
+
+  start = rdtsc ();
+  exec_children ("child-linear", children, CHILD_CNT);
+  copy_file ();
+  wait_linear (children);
+  both = rdtsc () - start;
+
+  printf ("copy alone: %llu cycles\n", copy);
+  printf ("paging alone: %llu cycles\n", paging);
+  printf ("both at once: %llu cycles, %llu%% of the two apart\n",
+          both, both * 100 / (copy + paging));
+}
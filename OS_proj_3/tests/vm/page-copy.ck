@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+
+# Timings differ from run to run, so only check that the run was
+# clean and got to its end.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+common_checks ("run", @output);
+@output = get_core_output ("run", @output);
+fail "\"(page-copy) end\" missing from output\n"
+  if !grep ($_ eq "(page-copy) end", @output);
+pass;
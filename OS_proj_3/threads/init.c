@@ -34,6 +34,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/directory.h"
@@ -56,6 +57,9 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: Size of RAM disk "rd0" in sectors, 0 for none. */
+static size_t ramdisk_sectors;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -130,6 +134,7 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init (ramdisk_sectors);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -262,6 +267,10 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-dma"))
+        ide_use_dma = true;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -388,6 +397,8 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -dma               Use bus-master DMA for IDE disks if possible.\n"
+          "  -ramdisk=SECTORS   Create RAM disk rd0 of SECTORS sectors.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -1,4 +1,9 @@
 #include "swap.h"
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
 
 struct block *swap_device;
 struct bitmap *swap_bitmap;
@@ -6,6 +11,31 @@ struct bitmap *swap_bitmap;
 /* 4096 / 512 = 8 */
 const size_t BLOCKS_PER_PAGE = PGSIZE / BLOCK_SECTOR_SIZE;
 
+/* most pages on their way out to swap at once. Beyond this,
+   swap_out() waits for its write like it used to */
+#define SWAP_WRITES_MAX 16
+
+/* A page on its way out to swap. swap_out() copies the page here and
+   returns at once, so the evicting thread can go on to load the new
+   page, often from the file system disk on the other IDE channel,
+   while the swap disk is still writing this one. */
+struct swap_write
+  {
+    struct block_request request;   /* Write of PAGE to the slot. */
+    size_t swap_index;              /* Swap slot being written. */
+    void *page;                     /* Copy of the evicted page. */
+    bool swapped_in;                /* Read back before written? */
+    struct list_elem elem;          /* In swap_writes. */
+  };
+
+// protects swap_bitmap and swap_writes
+static struct lock swap_lock;
+// writes in flight
+static struct list swap_writes;
+static size_t swap_write_cnt;
+
+static void swap_write_done (struct block_request *);
+
 void
 swap_init (void)
 {
@@ -21,34 +51,103 @@ swap_init (void)
 
     // set all entries to true: all empty
     bitmap_set_all(swap_bitmap, true);
+
+    lock_init (&swap_lock);
+    list_init (&swap_writes);
+    swap_write_cnt = 0;
 }
 
 void
 swap_in (size_t swap_index, void *kpage)
 {
-    // iteratively read in blocks in a page
-    for (int i = 0; i < BLOCKS_PER_PAGE; ++i)
-    {
-        block_read (swap_device, swap_index*BLOCKS_PER_PAGE + i, 
-                    kpage + i*BLOCK_SECTOR_SIZE);
+    lock_acquire (&swap_lock);
+    for (struct list_elem *e = list_begin (&swap_writes);
+         e != list_end (&swap_writes); e = list_next (e)){
+        struct swap_write *w = list_entry (e, struct swap_write, elem);
+        if (w->swap_index == swap_index){
+            // still being written: take the copy, and let the write
+            // free the slot when it's done
+            memcpy (kpage, w->page, PGSIZE);
+            w->swapped_in = true;
+            lock_release (&swap_lock);
+            return;
+        }
     }
+    lock_release (&swap_lock);
+
+    // read in all the blocks of the page with one disk command
+    block_read_multiple (swap_device, swap_index*BLOCKS_PER_PAGE,
+                         BLOCKS_PER_PAGE, kpage);
+    lock_acquire (&swap_lock);
     bitmap_set (swap_bitmap, swap_index, true);
+    lock_release (&swap_lock);
 }
 
 size_t
 swap_out (void *kpage)
 {
-    // search for empty swaps
-    size_t swap_index = bitmap_scan (swap_bitmap, 0, 1, true);
+    // search for an empty swap and take it: set to false, not empty
+    lock_acquire (&swap_lock);
+    size_t swap_index = bitmap_scan_and_flip (swap_bitmap, 0, 1, true);
     ASSERT (swap_index != BITMAP_ERROR);
+    bool async = swap_write_cnt < SWAP_WRITES_MAX;
+    if (async)
+        swap_write_cnt++;
+    lock_release (&swap_lock);
 
-    // iteratively write KPAGE into swap
-    for (int i = 0; i < BLOCKS_PER_PAGE; ++i)
-    {
-        block_write (swap_device, swap_index*BLOCKS_PER_PAGE + i,
-                     kpage + i*BLOCK_SECTOR_SIZE);
+    struct swap_write *w = NULL;
+    if (async){
+        w = malloc (sizeof *w);
+        if (w != NULL){
+            w->page = palloc_get_page (0);
+            if (w->page == NULL){
+                free (w);
+                w = NULL;
+            }
+        }
+    }
+    if (w == NULL){
+        if (async){
+            lock_acquire (&swap_lock);
+            swap_write_cnt--;
+            lock_release (&swap_lock);
+        }
+        // write KPAGE into swap with one disk command, and wait
+        block_write_multiple (swap_device, swap_index*BLOCKS_PER_PAGE,
+                              BLOCKS_PER_PAGE, kpage);
+        return swap_index;
     }
-    // set to false: these swaps are not empty
-    bitmap_set (swap_bitmap, swap_index, false);
+
+    // queue the write of a copy, so KPAGE can be reused right away
+    memcpy (w->page, kpage, PGSIZE);
+    w->swap_index = swap_index;
+    w->swapped_in = false;
+    block_request_init (&w->request, true, swap_index*BLOCKS_PER_PAGE,
+                        BLOCKS_PER_PAGE, w->page);
+    w->request.complete = swap_write_done;
+    w->request.aux = w;
+    lock_acquire (&swap_lock);
+    list_push_back (&swap_writes, &w->elem);
+    lock_release (&swap_lock);
+    block_submit (swap_device, &w->request);
     return swap_index;
-}
\ No newline at end of file
+}
+
+/* Completion hook for a write queued by swap_out(). Runs in the swap
+   device's dispatcher thread. */
+static void
+swap_write_done (struct block_request *r)
+{
+    struct swap_write *w = r->aux;
+
+    lock_acquire (&swap_lock);
+    list_remove (&w->elem);
+    swap_write_cnt--;
+    // read back already: the slot is empty again
+    if (w->swapped_in)
+        bitmap_set (swap_bitmap, w->swap_index, true);
+    lock_release (&swap_lock);
+
+    palloc_free_page (w->page);
+    free (w);
+}
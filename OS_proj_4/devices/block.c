@@ -3,7 +3,30 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Most sectors the dispatcher merges into one transfer. */
+#define MERGE_MAX 64
+
+/* Ticks a queued read or write may wait before the dispatcher
+   serves it ahead of the elevator order.  Reads are usually
+   waited on, writes usually not, hence the difference. */
+#define READ_EXPIRE (TIMER_FREQ / 2)
+#define WRITE_EXPIRE (TIMER_FREQ * 5)
+
+/* Buckets in the latency and queue depth histograms.  Latency
+   bucket I counts requests that took between 2**I and 2**(I+1)
+   TSC cycles from submission to completion.  Depth bucket 0
+   counts requests submitted to an idle device, and bucket I > 0
+   those that found between 2**(I-1) and 2**I - 1 requests queued
+   or in progress; the last bucket of each also counts anything
+   bigger. */
+#define LATENCY_BUCKETS 40
+#define DEPTH_BUCKETS 8
 
 /* A block device. */
 struct block
@@ -19,6 +42,23 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long merge_cnt;       /* Requests merged into others. */
+    unsigned long long latency[2][LATENCY_BUCKETS]; /* Reads, writes. */
+    unsigned long long depth[DEPTH_BUCKETS];        /* Depth at submit. */
+    size_t depth_max;                   /* Greatest depth at submit. */
+    unsigned long long seek_sum;        /* Sectors moved between transfers. */
+    unsigned long long seek_cnt;        /* Transfers counted in seek_sum. */
+
+    /* Request queue. */
+    struct lock queue_lock;             /* Protects members below. */
+    struct list queue;                  /* Pending requests by sector. */
+    struct list deadlines;              /* Pending requests by deadline. */
+    struct condition queue_cond;        /* Work queued or device idle. */
+    size_t queue_cnt;                   /* Number of requests queued. */
+    bool busy;                          /* Transfer in progress? */
+    bool dispatching;                   /* Dispatcher thread started? */
+    block_sector_t head;                /* Sector after last transfer. */
+    uint8_t *bounce;                    /* MERGE_MAX sectors, or null. */
   };
 
 /* List of all block devices. */
@@ -28,6 +68,16 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static inline uint64_t rdtsc (void);
+static void count_depth (struct block *);
+static void count_seek (struct block *, block_sector_t);
+static void count_latency (struct block *, const struct block_request *,
+                           uint64_t now);
+static void print_histogram (const char *name, const char *what,
+                             const unsigned long long *, int bucket_cnt);
+static void transfer (struct block *, bool write, block_sector_t,
+                      size_t cnt, void *buffer);
+static void dispatch (void *block_);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +170,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +181,360 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  Drivers that can move several sectors with one command
+   do so; for others this is the same as CNT calls to
+   block_read().
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, false, sector, cnt, buffer);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes.
+   Returns after the block device has acknowledged receiving all
+   of the data.  Drivers that can move several sectors with one
+   command do so; for others this is the same as CNT calls to
+   block_write().
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                      const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, true, sector, cnt, (void *) buffer);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R as a request to transfer CNT sectors starting at
+   SECTOR into BUFFER if WRITE is false, or out of it if WRITE is
+   true, with no completion hook. */
+void
+block_request_init (struct block_request *r, bool write,
+                    block_sector_t sector, size_t cnt, void *buffer)
+{
+  r->write = write;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->complete = NULL;
+  r->aux = NULL;
+  sema_init (&r->done, 0);
+}
+
+/* Returns true if request A's sector precedes request B's. */
+static bool
+request_sector_less (const struct list_elem *a_, const struct list_elem *b_,
+                     void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request,
+                                              queue_elem);
+  const struct block_request *b = list_entry (b_, struct block_request,
+                                              queue_elem);
+  return a->sector < b->sector;
+}
+
+/* Returns true if request A's deadline precedes request B's. */
+static bool
+request_deadline_less (const struct list_elem *a_,
+                       const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request,
+                                              deadline_elem);
+  const struct block_request *b = list_entry (b_, struct block_request,
+                                              deadline_elem);
+  return a->deadline < b->deadline;
+}
+
+/* Finishes request R: calls its completion hook, if any, or
+   else wakes up block_wait(). */
+static void
+complete_request (struct block_request *r)
+{
+  if (r->complete != NULL)
+    r->complete (r);
+  else
+    sema_up (&r->done);
+}
+
+/* Queues request R for BLOCK and returns without waiting for it.
+   If BLOCK is idle and nothing else is queued, a request with no
+   completion hook is carried out right away by the calling
+   thread, since there is nothing to sort it against; otherwise
+   BLOCK's dispatcher thread carries it out in elevator order,
+   merged with requests for adjacent sectors.
+
+   The dispatcher can't reach buffers in user memory, so a request
+   with such a buffer must have no completion hook.  It waits for
+   BLOCK to go idle and then is carried out by the calling thread,
+   ahead of anything queued.
+
+   Requests for overlapping sectors may be carried out in any
+   order, so a caller must not have a write in flight together
+   with another read or write of the same sector. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  bool user = !is_kernel_vaddr (r->buffer);
+
+  ASSERT (r->cnt > 0);
+  ASSERT (!user || r->complete == NULL);
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  r->submit_tsc = rdtsc ();
+  lock_acquire (&block->queue_lock);
+  count_depth (block);
+  if (user)
+    while (block->busy)
+      cond_wait (&block->queue_cond, &block->queue_lock);
+  if (!block->busy && r->complete == NULL
+      && (user || list_empty (&block->queue)))
+    {
+      block->busy = true;
+      lock_release (&block->queue_lock);
+
+      transfer (block, r->write, r->sector, r->cnt, r->buffer);
+
+      lock_acquire (&block->queue_lock);
+      count_latency (block, r, rdtsc ());
+      count_seek (block, r->sector);
+      block->busy = false;
+      block->head = r->sector + r->cnt;
+      if (r->write)
+        block->write_cnt += r->cnt;
+      else
+        block->read_cnt += r->cnt;
+      cond_broadcast (&block->queue_cond, &block->queue_lock);
+      lock_release (&block->queue_lock);
+      sema_up (&r->done);
+      return;
+    }
+
+  if (!block->dispatching)
+    {
+      char name[sizeof block->name + 4];
+
+      snprintf (name, sizeof name, "blk-%s", block->name);
+      if (thread_create (name, PRI_DEFAULT, dispatch, block) == TID_ERROR)
+        PANIC ("%s: failed to start request dispatcher", block->name);
+      block->dispatching = true;
+    }
+  r->deadline = timer_ticks () + (r->write ? WRITE_EXPIRE : READ_EXPIRE);
+  list_insert_ordered (&block->queue, &r->queue_elem,
+                       request_sector_less, NULL);
+  list_insert_ordered (&block->deadlines, &r->deadline_elem,
+                       request_deadline_less, NULL);
+  block->queue_cnt++;
+  cond_signal (&block->queue_cond, &block->queue_lock);
+  lock_release (&block->queue_lock);
+}
+
+/* Waits for request R, which must have no completion hook, to
+   complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->complete == NULL);
+  sema_down (&r->done);
+}
+
+/* Chooses the next request for BLOCK's dispatcher, whose queue
+   must not be empty.  This is C-LOOK, which sweeps upward from
+   the last sector transferred and then jumps back to the lowest
+   queued sector, except that a request past its deadline goes
+   first. */
+static struct block_request *
+elevator_next (struct block *block)
+{
+  struct block_request *oldest;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  ASSERT (!list_empty (&block->queue));
+
+  oldest = list_entry (list_front (&block->deadlines),
+                       struct block_request, deadline_elem);
+  if (timer_ticks () >= oldest->deadline)
+    return oldest;
+
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            queue_elem);
+      if (r->sector >= block->head)
+        return r;
+    }
+  return list_entry (list_front (&block->queue),
+                     struct block_request, queue_elem);
+}
+
+/* Removes FIRST from BLOCK's queue, along with the queued
+   requests that follow it in the same direction on contiguous
+   sectors, up to MERGE_MAX sectors in all, and puts them in RUN
+   in sector order.  Requests can only be merged if BLOCK has a
+   bounce buffer or their buffers happen to be contiguous too.
+   Returns the number of sectors in RUN. */
+static size_t
+elevator_merge (struct block *block, struct block_request *first,
+                struct list *run)
+{
+  struct list_elem *e = list_next (&first->queue_elem);
+  size_t cnt = first->cnt;
+
+  list_remove (&first->queue_elem);
+  list_remove (&first->deadline_elem);
+  list_push_back (run, &first->queue_elem);
+  block->queue_cnt--;
+  while (e != list_end (&block->queue))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            queue_elem);
+      if (r->write != first->write
+          || r->sector != first->sector + cnt
+          || cnt + r->cnt > MERGE_MAX
+          || (block->bounce == NULL
+              && r->buffer != (uint8_t *) first->buffer
+                                + cnt * BLOCK_SECTOR_SIZE))
+        break;
+
+      e = list_remove (e);
+      list_remove (&r->deadline_elem);
+      list_push_back (run, &r->queue_elem);
+      block->queue_cnt--;
+      cnt += r->cnt;
+      block->merge_cnt++;
+    }
+  return cnt;
+}
+
+/* Moves CNT sectors starting at SECTOR between BLOCK and BUFFER
+   through its driver, without queuing. */
+static void
+transfer (struct block *block, bool write, block_sector_t sector,
+          size_t cnt, void *buffer)
+{
+  size_t i;
+
+  if (write && block->ops->write_multiple != NULL)
+    block->ops->write_multiple (block->aux, sector, cnt, buffer);
+  else if (write)
+    for (i = 0; i < cnt; i++)
+      block->ops->write (block->aux, sector + i,
+                         (const uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+  else if (block->ops->read_multiple != NULL)
+    block->ops->read_multiple (block->aux, sector, cnt, buffer);
+  else
+    for (i = 0; i < cnt; i++)
+      block->ops->read (block->aux, sector + i,
+                        (uint8_t *) buffer + i * BLOCK_SECTOR_SIZE);
+}
+
+/* Copies the data of the requests in RUN, which together cover
+   consecutive sectors, between their buffers and the contiguous
+   buffer BOUNCE: into BOUNCE if TO_BOUNCE, out of it otherwise. */
+static void
+copy_run (struct list *run, uint8_t *bounce, bool to_bounce)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (run); e != list_end (run); e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request,
+                                            queue_elem);
+      size_t size = r->cnt * BLOCK_SECTOR_SIZE;
+
+      if (to_bounce)
+        memcpy (bounce, r->buffer, size);
+      else
+        memcpy (r->buffer, bounce, size);
+      bounce += size;
+    }
+}
+
+/* Dispatcher thread for block device BLOCK_.  Carries out queued
+   requests one merged run at a time, in the order chosen by
+   elevator_next(), whenever no other transfer is in progress.
+   Devices are independent, each with its own dispatcher, so disks
+   on different IDE channels transfer at the same time. */
+static void
+dispatch (void *block_)
+{
+  struct block *block = block_;
+
+  block->bounce = palloc_get_multiple (0, MERGE_MAX * BLOCK_SECTOR_SIZE
+                                          / PGSIZE);
+  for (;;)
+    {
+      struct block_request *first;
+      struct list run;
+      struct list_elem *e;
+      uint64_t now;
+      size_t cnt;
+      void *buffer;
+
+      lock_acquire (&block->queue_lock);
+      while (block->busy || list_empty (&block->queue))
+        cond_wait (&block->queue_cond, &block->queue_lock);
+      first = elevator_next (block);
+      list_init (&run);
+      cnt = elevator_merge (block, first, &run);
+      block->busy = true;
+      lock_release (&block->queue_lock);
+
+      /* A run of one request, or of requests whose buffers are
+         contiguous, needs no bounce buffer. */
+      buffer = first->buffer;
+      if (cnt > first->cnt && block->bounce != NULL)
+        {
+          buffer = block->bounce;
+          if (first->write)
+            copy_run (&run, buffer, true);
+        }
+      transfer (block, first->write, first->sector, cnt, buffer);
+      if (buffer == block->bounce && !first->write)
+        copy_run (&run, buffer, false);
+
+      now = rdtsc ();
+      lock_acquire (&block->queue_lock);
+      for (e = list_begin (&run); e != list_end (&run); e = list_next (e))
+        count_latency (block,
+                       list_entry (e, struct block_request, queue_elem), now);
+      count_seek (block, first->sector);
+      block->busy = false;
+      block->head = first->sector + cnt;
+      if (first->write)
+        block->write_cnt += cnt;
+      else
+        block->read_cnt += cnt;
+      cond_broadcast (&block->queue_cond, &block->queue_lock);
+      lock_release (&block->queue_lock);
+
+      while (!list_empty (&run))
+        complete_request (list_entry (list_pop_front (&run),
+                                      struct block_request, queue_elem));
+    }
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -171,13 +569,106 @@ block_print_stats (void)
       struct block *block = block_by_role[i];
       if (block != NULL)
         {
-          printf ("%s (%s): %llu reads, %llu writes\n",
+          printf ("%s (%s): %llu reads, %llu writes, %llu merged\n",
                   block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
+                  block->read_cnt, block->write_cnt, block->merge_cnt);
+          print_histogram (block->name, "read latency, log2 cycles",
+                           block->latency[0], LATENCY_BUCKETS);
+          print_histogram (block->name, "write latency, log2 cycles",
+                           block->latency[1], LATENCY_BUCKETS);
+          print_histogram (block->name, "queue depth at submit, 0 or log2+1",
+                           block->depth, DEPTH_BUCKETS);
+          printf ("%s: queue depth at most %zu\n",
+                  block->name, block->depth_max);
+          printf ("%s: %llu transfers, average seek distance %llu "
+                  "sectors\n", block->name, block->seek_cnt,
+                  block->seek_cnt > 0 ? block->seek_sum / block->seek_cnt
+                                      : 0);
         }
     }
 }
 
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+/* Returns the base-2 logarithm of X, rounded down, or 0 if X
+   is 0. */
+static int
+log2_floor (uint64_t x)
+{
+  int log = 0;
+
+  while (x >>= 1)
+    log++;
+  return log;
+}
+
+/* Counts the depth of BLOCK's queue, including any transfer in
+   progress, at submission of a new request. */
+static void
+count_depth (struct block *block)
+{
+  size_t depth = block->queue_cnt + block->busy;
+  int bucket = depth == 0 ? 0 : log2_floor (depth) + 1;
+
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  block->depth[bucket < DEPTH_BUCKETS ? bucket : DEPTH_BUCKETS - 1]++;
+  if (depth > block->depth_max)
+    block->depth_max = depth;
+}
+
+/* Counts how far BLOCK's head moved, from the sector after the last
+   transfer, for a transfer that started at SECTOR. */
+static void
+count_seek (struct block *block, block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  block->seek_sum += sector >= block->head ? sector - block->head
+                                           : block->head - sector;
+  block->seek_cnt++;
+}
+
+/* Counts the time request R took on BLOCK, from its submission to
+   NOW, a TSC reading. */
+static void
+count_latency (struct block *block, const struct block_request *r,
+               uint64_t now)
+{
+  int bucket = log2_floor (now - r->submit_tsc);
+
+  ASSERT (lock_held_by_current_thread (&block->queue_lock));
+  block->latency[r->write][bucket < LATENCY_BUCKETS
+                           ? bucket : LATENCY_BUCKETS - 1]++;
+}
+
+/* Prints the nonzero buckets of histogram HIST, which has
+   BUCKET_CNT buckets, on one line headed by NAME and WHAT.  Prints
+   nothing if all of them are zero. */
+static void
+print_histogram (const char *name, const char *what,
+                 const unsigned long long *hist, int bucket_cnt)
+{
+  bool any = false;
+  int i;
+
+  for (i = 0; i < bucket_cnt; i++)
+    if (hist[i] != 0)
+      {
+        if (!any)
+          printf ("%s %s:", name, what);
+        printf (" %d:%llu", i, hist[i]);
+        any = true;
+      }
+  if (any)
+    printf ("\n");
+}
+
 /* Registers a new block device with the given NAME.  If
    EXTRA_INFO is non-null, it is printed as part of a user
    message.  The block device's SIZE in sectors and its TYPE must
@@ -200,6 +691,21 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->merge_cnt = 0;
+  memset (block->latency, 0, sizeof block->latency);
+  memset (block->depth, 0, sizeof block->depth);
+  block->depth_max = 0;
+  block->seek_sum = 0;
+  block->seek_cnt = 0;
+  block->queue_cnt = 0;
+  lock_init (&block->queue_lock);
+  list_init (&block->queue);
+  list_init (&block->deadlines);
+  cond_init (&block->queue_cond);
+  block->busy = false;
+  block->dispatching = false;
+  block->head = 0;
+  block->bounce = NULL;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
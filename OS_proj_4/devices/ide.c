@@ -5,10 +5,13 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -34,6 +37,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +53,52 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one command can transfer: a sector count of 0 in
+   reg_nsect means 256. */
+#define MAX_NSECT 256
+
+/* PCI bus-master IDE registers, per channel, as found on the
+   Intel PIIX and the many controllers compatible with it.  See
+   [PIIX] for details. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0)   /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)    /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)      /* PRD table. */
+
+/* Bus-master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start/stop bus master. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus-master Status Register bits. */
+#define BM_STA_ERR 0x02         /* Transfer failed.  Write 1 to clear. */
+#define BM_STA_IRQ 0x04         /* Disk interrupted.  Write 1 to clear. */
+
+/* A Physical Region Descriptor: one physically contiguous piece
+   of a DMA transfer.  A piece may not cross a 64 kB boundary, and
+   a size of 0 means 64 kB. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes. */
+    uint16_t flags;             /* PRD_EOT in the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* PCI class of an IDE controller, and the bit in its
+   programming interface byte that says it can do bus mastering. */
+#define PCI_CLASS_IDE 0x0101    /* Mass storage, IDE. */
+#define PCI_PROGIF_MASTER 0x80  /* Supports bus mastering. */
+
+/* If true, use bus-master DMA where the controller supports it.
+   If false (default), use PIO only.
+   Controlled by kernel command-line option "-dma". */
+bool ide_use_dma;
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +107,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Use bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +125,9 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus-master registers, 0 if none. */
+    struct prd *prdt;           /* PRD table for bus-master DMA. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,20 +137,30 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+static uint16_t find_bus_master (void);
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void set_multiple_mode (struct ata_disk *, int max_multiple);
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
-static void output_sector (struct channel *, const void *);
+static void input_sectors (struct channel *, void *, size_t cnt);
+static void output_sectors (struct channel *, const void *, size_t cnt);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static bool dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool read);
+static void ide_read_multiple (void *d_, block_sector_t, size_t cnt,
+                               void *buffer);
+static void ide_write_multiple (void *d_, block_sector_t, size_t cnt,
+                                const void *buffer);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
@@ -102,6 +168,7 @@ void
 ide_init (void) 
 {
   size_t chan_no;
+  uint16_t bm_base = ide_use_dma ? find_bus_master () : 0;
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -126,6 +193,22 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+
+      /* Set up bus-master DMA, if we have a controller for it.
+         The PRD table may not cross a 64 kB boundary, which a
+         page never does. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0)
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            {
+              c->bm_base = bm_base + chan_no * 8;
+              printf ("%s: bus-master DMA at port 0x%04"PRIx16"\n",
+                      c->name, c->bm_base);
+            }
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +219,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -157,6 +242,41 @@ ide_init (void)
 
 /* Disk detection and identification. */
 
+/* pci_scan() function for find_bus_master().  Stops at the first
+   IDE controller that can do bus-master DMA, turns on its bus
+   mastering, and stores the I/O base of its bus-master registers
+   into *BM_BASE_. */
+static bool
+found_bus_master (int bus, int dev, int func, uint32_t id UNUSED,
+                  uint32_t class, void *bm_base_) 
+{
+  uint16_t *bm_base = bm_base_;
+  uint32_t bar4;
+
+  if (class >> 16 != PCI_CLASS_IDE || !(class & (PCI_PROGIF_MASTER << 8)))
+    return false;
+  bar4 = pci_read_config (bus, dev, func, PCI_REG_BAR4);
+  if (!(bar4 & 1) || (bar4 & 0xfffc) == 0)
+    return false;
+
+  pci_enable (bus, dev, func);
+  *bm_base = bar4 & 0xfffc;
+  return true;
+}
+
+/* Looks for an IDE controller that can do bus-master DMA, such as
+   the PIIX that QEMU and Bochs emulate, and turns on its bus
+   mastering.  Returns the I/O base of its bus-master registers, or
+   0 if there is no such controller. */
+static uint16_t
+find_bus_master (void) 
+{
+  uint16_t bm_base = 0;
+
+  pci_scan (found_bus_master, &bm_base);
+  return bm_base;
+}
+
 static char *descramble_ata_string (char *, int size);
 
 /* Resets an ATA channel and waits for any devices present on it
@@ -303,6 +423,14 @@ identify_ata_device (struct ata_disk *d)
       return;
     }
 
+  /* Let READ/WRITE MULTIPLE move as many sectors per interrupt as
+     the disk allows, given in the low byte of word 47. */
+  set_multiple_mode (d, (uint8_t) id[47 * 2]);
+
+  /* Use DMA if the channel has a bus master and the disk says it
+     supports DMA, in bit 8 of word 49. */
+  d->dma = c->bm_base != 0 && (id[49 * 2 + 1] & 0x01) != 0;
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
@@ -337,6 +465,30 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Sends a SET MULTIPLE MODE command to disk D for the largest
+   power of 2 no greater than MAX_MULTIPLE sectors per interrupt,
+   and records it in D if the disk accepts it. */
+static void
+set_multiple_mode (struct ata_disk *d, int max_multiple) 
+{
+  struct channel *c = d->channel;
+  int multiple;
+
+  d->multiple = 0;
+  if (max_multiple < 2)
+    return;
+  for (multiple = 2; multiple * 2 <= max_multiple; multiple *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -344,16 +496,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,37 +506,192 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, buffer);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes.  Each
+   command moves up to MAX_NSECT sectors, by bus-master DMA if
+   possible, else with READ MULTIPLE if the disk supports it so
+   that it interrupts once per D->multiple sectors rather than once
+   per sector.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+      size_t per_irq = d->multiple > 0 ? d->multiple : 1;
+      size_t done;
+
+      if (!dma_transfer (d, sec_no, nsect, buffer, true))
+        {
+          select_sectors (d, sec_no, nsect);
+          issue_pio_command (c, d->multiple > 0
+                             ? CMD_READ_MULTIPLE : CMD_READ_SECTOR_RETRY);
+          for (done = 0; done < nsect; done += per_irq)
+            {
+              size_t n = nsect - done < per_irq ? nsect - done : per_irq;
+
+              sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                       d->name, sec_no + done);
+              input_sectors (c, buffer + done * BLOCK_SECTOR_SIZE, n);
+            }
+        }
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, the same way
+   as ide_read_multiple().  Returns after the disk has
+   acknowledged receiving all of the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t nsect = cnt < MAX_NSECT ? cnt : MAX_NSECT;
+      size_t per_irq = d->multiple > 0 ? d->multiple : 1;
+      size_t done;
+
+      if (!dma_transfer (d, sec_no, nsect, (void *) buffer, false))
+        {
+          select_sectors (d, sec_no, nsect);
+          issue_pio_command (c, d->multiple > 0
+                             ? CMD_WRITE_MULTIPLE : CMD_WRITE_SECTOR_RETRY);
+          /* The disk asks for the first block without an interrupt,
+             then interrupts after each block it has taken. */
+          for (done = 0; done < nsect; done += per_irq)
+            {
+              size_t n = nsect - done < per_irq ? nsect - done : per_irq;
+
+              if (done > 0)
+                sema_down (&c->completion_wait);
+              if (!wait_while_busy (d))
+                PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                       d->name, sec_no + done);
+              output_sectors (c, buffer + done * BLOCK_SECTOR_SIZE, n);
+            }
+          sema_down (&c->completion_wait);
+        }
+      sec_no += nsect;
+      buffer += nsect * BLOCK_SECTOR_SIZE;
+      cnt -= nsect;
+    }
   lock_release (&c->lock);
 }
 
+/* Moves CNT sectors, at most MAX_NSECT, starting at SEC_NO
+   between disk D and BUFFER by bus-master DMA: into BUFFER if
+   READ, out of it otherwise.  The CPU is free to run other threads
+   until the disk interrupts at the end.  Must be called with D's
+   channel lock held.  Returns false, having done nothing, if D or
+   BUFFER can't be used for DMA, in which case the caller should
+   use PIO.  If the transfer fails, DMA is turned off for D and
+   false is returned too, so that the caller retries with PIO. */
+static bool
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool read) 
+{
+  struct channel *c = d->channel;
+  uint8_t bm_read = read ? BM_CMD_READ : 0;
+  uint32_t addr;
+  size_t left;
+  struct prd *prd;
+  uint8_t bm_status, status;
+
+  ASSERT (lock_held_by_current_thread (&c->lock));
+  ASSERT (cnt >= 1 && cnt <= MAX_NSECT);
+  if (!d->dma || !is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1))
+    return false;
+
+  /* Describe BUFFER, which is physically contiguous since it is
+     kernel memory, in pieces that don't cross 64 kB boundaries. */
+  addr = vtop (buffer);
+  left = cnt * BLOCK_SECTOR_SIZE;
+  for (prd = c->prdt; ; prd++)
+    {
+      size_t size = 0x10000 - (addr & 0xffff);
+      if (size > left)
+        size = left;
+      prd->addr = addr;
+      prd->size = size & 0xffff;
+      prd->flags = 0;
+      addr += size;
+      left -= size;
+      if (left == 0)
+        break;
+    }
+  prd->flags = PRD_EOT;
+
+  /* Point the bus master at the table, clear its status, and
+     start it once the disk has the command. */
+  outb (reg_bm_command (c), bm_read);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+  select_sectors (d, sec_no, cnt);
+  issue_pio_command (c, read ? CMD_READ_DMA : CMD_WRITE_DMA);
+  outb (reg_bm_command (c), bm_read | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), bm_read);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_STA_ERR | BM_STA_IRQ);
+  status = inb (reg_status (c));
+  if ((bm_status & BM_STA_ERR) || (status & STA_ERR))
+    {
+      printf ("%s: DMA %s failed, sector=%"PRDSNu", falling back to PIO\n",
+              d->name, read ? "read" : "write", sec_no);
+      d->dma = false;
+      return false;
+    }
+  return true;
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT, which must be between 1 and MAX_NSECT,
+   to the disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt >= 1 && cnt <= MAX_NSECT);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_NSECT);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -421,15 +719,24 @@ input_sector (struct channel *c, void *sector)
 {
   insw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
+
+/* Reads CNT sectors from channel C's data register in PIO mode
+   into SECTORS, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes. */
+static void
+input_sectors (struct channel *c, void *sectors, size_t cnt) 
+{
+  insw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
+}
 
-/* Writes SECTOR to channel C's data register in PIO mode.
-   SECTOR must contain BLOCK_SECTOR_SIZE bytes. */
+/* Writes CNT sectors from SECTORS to channel C's data register in
+   PIO mode.  SECTORS must contain CNT * BLOCK_SECTOR_SIZE bytes. */
 static void
-output_sector (struct channel *c, const void *sector) 
+output_sectors (struct channel *c, const void *sectors, size_t cnt) 
 {
-  outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
+  outsw (reg_data (c), sectors, cnt * BLOCK_SECTOR_SIZE / 2);
 }
-
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
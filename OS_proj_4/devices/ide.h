@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* If true, use bus-master DMA where the controller supports it.
+   If false (default), use PIO only.
+   Controlled by kernel command-line option "-dma". */
+extern bool ide_use_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
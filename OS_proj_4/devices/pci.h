@@ -0,0 +1,30 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* PCI configuration space registers that Pintos drivers use. */
+#define PCI_REG_ID 0x00         /* Vendor ID, Device ID. */
+#define PCI_REG_COMMAND 0x04    /* Command (low 16 bits). */
+#define PCI_REG_CLASS 0x08      /* Revision, Prog IF, Subclass, Class. */
+#define PCI_REG_BAR0 0x10       /* Base address 0. */
+#define PCI_REG_BAR4 0x20       /* Base address 4. */
+#define PCI_REG_INTR 0x3c       /* Interrupt line (low 8 bits). */
+
+/* Command register bits. */
+#define PCI_CMD_IO 0x0001       /* Enable I/O space. */
+#define PCI_CMD_MASTER 0x0004   /* Enable bus mastering. */
+
+/* Called by pci_scan() for each function present, with its
+   address, the contents of its ID and class registers, and the
+   AUX passed to pci_scan().  Returns true to stop the scan. */
+typedef bool pci_scan_func (int bus, int dev, int func,
+                            uint32_t id, uint32_t class, void *aux);
+
+uint32_t pci_read_config (int bus, int dev, int func, int reg);
+void pci_write_config (int bus, int dev, int func, int reg, uint32_t value);
+void pci_enable (int bus, int dev, int func);
+void pci_scan (pci_scan_func *, void *aux);
+
+#endif /* devices/pci.h */
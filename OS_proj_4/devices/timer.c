@@ -92,8 +92,18 @@ timer_sleep (int64_t ticks)
   int64_t start = timer_ticks ();
 
   ASSERT (intr_get_level () == INTR_ON);
-  while (timer_elapsed (start) < ticks) 
-    thread_yield ();
+  // while (timer_elapsed (start) < ticks) 
+  //   thread_yield ();
+  /************************ NEW CODE ***************************/
+  // block rather than yield, so a sleeping thread costs nothing until
+  // timer_interrupt() wakes it up
+  if (ticks <= 0)
+    return;
+  enum intr_level old_level = intr_disable ();
+  thread_current ()->sleep_ticks = start + ticks;
+  thread_block ();
+  intr_set_level (old_level);
+  /********************** END NEW CODE *************************/
 }
 
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
@@ -172,6 +182,10 @@ timer_interrupt (struct intr_frame *args UNUSED)
 {
   ticks++;
   thread_tick ();
+  /************************ NEW CODE ***************************/
+  // wake up the threads whose timer_sleep() is over
+  thread_foreach (check_thread_sleep, &ticks);
+  /********************** END NEW CODE *************************/
 }
 
 /* Returns true if LOOPS iterations waits for more than one timer
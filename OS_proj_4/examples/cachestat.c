@@ -0,0 +1,77 @@
+/* cachestat.c
+
+   Prints the buffer cache counters.  With a command line, runs it
+   and prints how much each counter changed while it ran, e.g.
+   "cachestat cp big big2". */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+
+static void print_stats (const struct cache_stats *now,
+                         const struct cache_stats *then);
+
+int
+main (int argc, char *argv[]) 
+{
+  struct cache_stats before, after;
+  char cmd_line[128];
+  pid_t pid;
+  int i;
+
+  if (!cache_stats (&before))
+    {
+      printf ("cachestat: cache_stats failed\n");
+      return EXIT_FAILURE;
+    }
+  if (argc < 2)
+    {
+      memset (&after, 0, sizeof after);
+      print_stats (&before, &after);
+      return EXIT_SUCCESS;
+    }
+
+  cmd_line[0] = '\0';
+  for (i = 1; i < argc; i++)
+    {
+      if (i > 1)
+        strlcat (cmd_line, " ", sizeof cmd_line);
+      strlcat (cmd_line, argv[i], sizeof cmd_line);
+    }
+  pid = exec (cmd_line);
+  if (pid == PID_ERROR)
+    {
+      printf ("cachestat: exec \"%s\" failed\n", cmd_line);
+      return EXIT_FAILURE;
+    }
+  printf ("\"%s\": exit code %d\n", cmd_line, wait (pid));
+  cache_stats (&after);
+  print_stats (&after, &before);
+  return EXIT_SUCCESS;
+}
+
+/* Prints each counter of NOW less the same counter of THEN. */
+static void
+print_stats (const struct cache_stats *now, const struct cache_stats *then) 
+{
+  unsigned long long hits = now->hits - then->hits;
+  unsigned long long misses = now->misses - then->misses;
+
+  printf ("%llu hits, %llu misses, %llu%% hit rate\n", hits, misses,
+          hits + misses > 0 ? hits * 100 / (hits + misses) : 0);
+  printf ("%llu clean and %llu dirty evictions\n",
+          now->clean_evictions - then->clean_evictions,
+          now->dirty_evictions - then->dirty_evictions);
+  printf ("%llu sector writes, %llu written to disk\n",
+          now->writes - then->writes,
+          now->disk_writes - then->disk_writes);
+  printf ("%llu sectors written behind in %llu batches\n",
+          now->flushes - then->flushes,
+          now->flush_batches - then->flush_batches);
+  printf ("%llu read-ahead hits, %llu wasted prefetches\n",
+          now->read_ahead_hits - then->read_ahead_hits,
+          now->read_ahead_wasted - then->read_ahead_wasted);
+  printf ("waited for the index lock %llu times, %llu cycles\n",
+          now->lock_waits - then->lock_waits,
+          now->lock_wait_cycles - then->lock_wait_cycles);
+}
@@ -1,27 +1,111 @@
 #include "filesys/cache.h"
 #include "filesys/filesys.h"
+#include "filesys/free-map.h"
 #include "threads/synch.h"
 #include "string.h"
 #include <stdio.h>
 #include "threads/thread.h"
 #include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+#include <hash.h>
+#include <round.h>
+#include <stdlib.h>
+
+/* number of cache entries if the -cache option isn't given */
+#define CACHE_DEFAULT_SIZE 64
+
+/* number of cache entries whose buffers share one page */
+#define CACHE_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* the cache may grow to this many times its boot-time size, and only
+   while every entry is pinned */
+#define CACHE_PINNED_GROWTH 2
+
+/* most sectors waiting in read_ahead_list. Requests beyond this are
+   dropped rather than letting prefetch fall further behind. */
+#define READ_AHEAD_QUEUE_MAX 64
+
+/* the write-behind thread starts writing dirty caches back once more
+   than CACHE_DIRTY_BACKGROUND percent of the cache is dirty, or a
+   cache has been dirty for CACHE_DIRTY_EXPIRE ticks. Writers wait for
+   it once dirty caches pass CACHE_DIRTY_HIGH percent. */
+#define CACHE_DIRTY_BACKGROUND 25
+#define CACHE_DIRTY_HIGH 50
+#define CACHE_DIRTY_EXPIRE (TIMER_FREQ / 2)
+
+/* ticks the write-behind thread sleeps at a time while it waits, so
+   it notices writers passing the background ratio soon enough */
+#define CACHE_FLUSH_SLICE 1
+
+/* most caches written back in one sorted batch */
+#define CACHE_FLUSH_BATCH 32
+
+/* replacement policies, picked with the -cache-policy option */
+enum cache_policy
+  {
+    CACHE_POLICY_CLOCK,     /* second chance on the accessed bit */
+    CACHE_POLICY_2Q         /* 2Q: A1in FIFO, Am LRU and A1out ghosts */
+  };
 
 /* the struct of cache entry */
 struct cache_sector
 {
-    // cache buffer
-    unsigned char buffer[BLOCK_SECTOR_SIZE];
-    // lock for EACH cache sector
+    // cache buffer, inside a page from palloc. NULL while that page
+    // isn't allocated
+    unsigned char *buffer;
+    // lock for EACH cache sector, guards loading, readers, writing
+    // and dirty
     struct lock cache_lock;
+    // signalled whenever this cache stops being loaded or held
+    struct condition cache_cond;
     // current cache's sector index
     block_sector_t sector_id;
-    // how many time this cache is accessed
+    // whether the cache was accessed since the clock hand last passed
+    // it. Under 2Q, whether it was accessed at all rather than only
+    // prefetched
     int accessed;
     // dirty bit
     bool dirty;
     // whether it's used
     bool used;
+    // whether the sector is still being read in from disk
+    bool loading;
+    // number of threads reading the buffer
+    int readers;
+    // whether a thread is writing the buffer
+    bool writing;
+    // number of threads holding or waiting for this cache. Guarded by
+    // cache_big_lock; a cache is only evicted when this is 0
+    int pin_cnt;
+    // element in the hash bucket of sector_id, valid only when used
+    struct list_elem hash_elem;
+    // element in cache_free_list while unused. Under 2Q, element in
+    // cache_a1in or cache_am while used
+    struct list_elem queue_elem;
+    // under 2Q: whether the cache is in cache_am rather than cache_a1in
+    bool hot;
+    // whether the cache was prefetched and hasn't been asked for since
+    bool prefetched;
+    // whether the cache is in cache_dirty_list. Guarded by cache_big_lock
+    bool dirty_queued;
+    // timer tick at which it joined cache_dirty_list
+    int64_t dirty_since;
+    // element in cache_dirty_list
+    struct list_elem dirty_elem;
+};
+
+/* a sector recently evicted from cache_a1in under 2Q. Only its number
+   is kept, so that reading it again soon after is known to be a
+   re-reference and it goes to cache_am */
+struct cache_ghost
+{
+    block_sector_t sector_id;
+    // element in the ghost hash bucket of sector_id
+    struct list_elem hash_elem;
+    // element in cache_a1out or cache_ghost_free
+    struct list_elem ghost_elem;
 };
 
 struct read_ahead_sector
@@ -30,12 +114,94 @@ struct read_ahead_sector
     struct list_elem read_ahead_elem;
 };
 
-/* the cache, which is an array of struct cache_sector */
-static struct cache_sector cache[64]; 
+/* the cache, which is an array of struct cache_sector. Only the
+   first cache_slot_cnt entries have buffers. The cache gets buffers
+   for cache_size entries at boot and gives pages back from the end
+   under memory pressure; it only grows, a page at a time up to
+   cache_max entries, when every entry is pinned. */
+static struct cache_sector *cache;
+
+// entries the cache gets at boot. Set by the -cache option
+static size_t cache_size = CACHE_DEFAULT_SIZE;
+
+// most entries the cache may grow to
+static size_t cache_max;
+
+// entries that have a buffer at the moment. Guarded by cache_big_lock
+static size_t cache_slot_cnt;
+
+// used entries. Guarded by cache_big_lock
+static size_t cache_used_cnt;
+
+// whether cache_shrink() is retiring the last page of buffers
+static bool cache_shrinking;
 
-// lock used for the whole cache operations
+/* sector -> cache index. Each bucket is a list of the used cache
+   entries whose sector_id hashes to it, so a lookup only compares
+   against the few entries sharing that bucket. The number of
+   buckets is a power of 2 so that a bucket is picked by masking. */
+static struct list *cache_hash;
+static size_t cache_hash_buckets;
+
+/* lock used for the cache index: cache_hash, used, sector_id,
+   accessed, pin_cnt and the clock hand. It is never held across
+   disk I/O; the buffers themselves are guarded by each entry's
+   cache_lock. */
 static struct lock cache_big_lock;
 
+// signalled when a cache becomes unpinned and so can be evicted
+static struct condition cache_free_cond;
+
+// the replacement policy. Set by the -cache-policy option
+static enum cache_policy cache_policy = CACHE_POLICY_2Q;
+
+// unused entries that have a buffer. Guarded by cache_big_lock
+static struct list cache_free_list;
+
+/* 2Q queues, guarded by cache_big_lock. A sector read for the first
+   time goes to the front of cache_a1in, a FIFO it leaves from the
+   back, so a long scan only ever pushes out its own sectors. Once
+   cache_a1in holds more than a quarter of the cache, its oldest
+   entries are evicted and remembered in cache_a1out; a sector read
+   again while remembered there was re-referenced, and goes to
+   cache_am, an LRU list of the hot sectors. */
+static struct list cache_a1in;
+static size_t cache_a1in_cnt;
+static struct list cache_am;
+
+// used entries of the page cache_shrink() is retiring, taken off
+// cache_a1in and cache_am so they can't be picked as victims or moved
+// meanwhile. Guarded by cache_big_lock
+static struct list cache_retiring;
+
+/* the A1out ghosts: cache_max / 2 of them, indexed by sector in
+   cache_ghost_hash, with the same number of buckets as cache_hash */
+static struct cache_ghost *cache_ghosts;
+static struct list cache_ghost_free;
+static struct list cache_a1out;
+static size_t cache_a1out_cnt;
+static struct list *cache_ghost_hash;
+
+/* dirty caches not being written back, oldest first, and how many
+   there are. Guarded by cache_big_lock */
+static struct list cache_dirty_list;
+static size_t cache_dirty_cnt;
+
+// caches being written back at the moment. Guarded by cache_big_lock
+static size_t cache_writeback_cnt;
+
+// signalled to wake the write-behind thread for more dirty caches
+static struct condition cache_flush_cond;
+
+// set when writers want the write-behind thread to start at once
+static bool cache_flush_kick;
+
+// signalled when write-backs finish, for throttled writers
+static struct condition cache_clean_cond;
+
+// the write-behind thread, which is never throttled
+static tid_t write_behind_tid = TID_ERROR;
+
 // list used for storing the next block of data
 static struct list read_ahead_list;
 
@@ -45,182 +211,1079 @@ static struct lock read_ahead_lock;
 // condition variable used for waiting read_ahead_list
 static struct condition read_ahead_condition;
 
+// number of sectors in read_ahead_list
+static int read_ahead_cnt;
+
 // current cache pointed. Used for clock algorithm
 int cache_cur;
 
+// counters for cache_print_stats() and the cache_stats system call.
+// Guarded by cache_big_lock
+static struct cache_stats cache_counts;
+
+static inline uint64_t rdtsc (void);
+
+/* Sets the sectors the cache holds from boot to SECTORS, rounded up
+   to a whole page of buffers. Must be called before cache_init(). */
+void cache_configure (size_t sectors)
+{
+    if (sectors < CACHE_PER_PAGE)
+        sectors = CACHE_PER_PAGE;
+    cache_size = ROUND_UP (sectors, CACHE_PER_PAGE);
+}
+
+/* Sets the replacement policy to NAME, "clock" or "2q". Must be
+   called before cache_init(). Returns false if NAME is unknown. */
+bool cache_set_policy (const char *name)
+{
+    if (!strcmp (name, "clock"))
+        cache_policy = CACHE_POLICY_CLOCK;
+    else if (!strcmp (name, "2q"))
+        cache_policy = CACHE_POLICY_2Q;
+    else
+        return false;
+    return true;
+}
+
 /*  The function used to initialize the whole 
     cache at the beginning of the system.   */
 void 
 cache_init ()
 {
     lock_init(&cache_big_lock);
-    cache_cur = -1;
-    for (int i = 0; i < 64; i ++){
-        memset (cache[i].buffer, 0, BLOCK_SECTOR_SIZE);
+    cond_init (&cache_free_cond);
+    cache_cur = 0;
+    cache_slot_cnt = 0;
+    cache_used_cnt = 0;
+    cache_shrinking = false;
+
+    list_init (&cache_free_list);
+    list_init (&cache_a1in);
+    cache_a1in_cnt = 0;
+    list_init (&cache_am);
+    list_init (&cache_retiring);
+    list_init (&cache_ghost_free);
+    list_init (&cache_a1out);
+    cache_a1out_cnt = 0;
+    list_init (&cache_dirty_list);
+    cache_dirty_cnt = 0;
+    cache_writeback_cnt = 0;
+    cond_init (&cache_flush_cond);
+    cache_flush_kick = false;
+    cond_init (&cache_clean_cond);
+
+    cache_max = cache_size * CACHE_PINNED_GROWTH;
+    cache = malloc (cache_max * sizeof *cache);
+    for (cache_hash_buckets = 1; cache_hash_buckets < cache_max;
+         cache_hash_buckets *= 2)
+        continue;
+    cache_hash = malloc (cache_hash_buckets * sizeof *cache_hash);
+    cache_ghosts = malloc (cache_max / 2 * sizeof *cache_ghosts);
+    cache_ghost_hash = malloc (cache_hash_buckets * sizeof *cache_ghost_hash);
+    if (cache == NULL || cache_hash == NULL || cache_ghosts == NULL
+        || cache_ghost_hash == NULL)
+        PANIC ("can't allocate %zu cache entries", cache_max);
+    for (size_t i = 0; i < cache_hash_buckets; i ++){
+        list_init (&cache_hash[i]);
+        list_init (&cache_ghost_hash[i]);
+    }
+    for (size_t i = 0; i < cache_max / 2; i ++)
+        list_push_back (&cache_ghost_free, &cache_ghosts[i].ghost_elem);
+    for (size_t i = 0; i < cache_max; i ++){
+        cache[i].buffer = NULL;
         lock_init (&cache[i].cache_lock);
+        cond_init (&cache[i].cache_cond);
         cache[i].sector_id = 0;
         cache[i].accessed = 0;
         cache[i].dirty = false;
         cache[i].used = false;
+        cache[i].loading = false;
+        cache[i].readers = 0;
+        cache[i].writing = false;
+        cache[i].pin_cnt = 0;
+        cache[i].hot = false;
+        cache[i].dirty_queued = false;
+        cache[i].prefetched = false;
     }
+    // take the boot-time size up front, so misses evict rather than
+    // take pages from the user pool as they go
+    cache_lock_index ();
+    while (cache_slot_cnt < cache_size && cache_grow ())
+        continue;
+    if (cache_slot_cnt == 0)
+        PANIC ("can't allocate a page for the cache");
+    lock_release(&cache_big_lock);
 
-    // lock_init (&read_ahead_lock);
-    // cond_init (&read_ahead_condition);
-    // list_init (&read_ahead_list);
-    // read_ahead();
+    lock_init (&read_ahead_lock);
+    cond_init (&read_ahead_condition);
+    list_init (&read_ahead_list);
+    read_ahead_cnt = 0;
+    read_ahead();
 
     write_behind();
 }
 
 void cache_read (block_sector_t sector_id, void *buffer)
 {
-    // read_ahead, remain to be fixed
-    /*
-    lock_acquire (&read_ahead_lock);
-    struct read_ahead_sector *ras = 
-             malloc (sizeof (struct read_ahead_sector));
-    ras->sector_id = sector_id + 1;
-    // if (ras->sector_id < 16) {
-        list_push_back (&read_ahead_list, &ras->read_ahead_elem);
-    // }
-    // else {
-        // free (ras);
-    // }
-    cond_signal (&read_ahead_condition, &read_ahead_lock);
-    lock_release (&read_ahead_lock);
-    */
-    
-    lock_acquire(&cache_big_lock);
-    int cache_id = find_sector (sector_id);
-    if (cache_id != -1){
-        // sector_id is in cache currently!
-        // read block from cache
-        memcpy (buffer, cache[cache_id].buffer, BLOCK_SECTOR_SIZE);
-    }
-    else {
+    int cache_id = cache_acquire (sector_id, false, true);
+    // read block from cache
+    memcpy (buffer, cache[cache_id].buffer, BLOCK_SECTOR_SIZE);
+    cache_release (cache_id, false, false);
+    // block_read (fs_device, sector_id, buffer);
+}
+
+void cache_write (block_sector_t sector_id, void *buffer)
+{
+    // the whole sector is overwritten, so a miss needn't read it in
+    int cache_id = cache_acquire (sector_id, true, false);
+    // write buffer to cache
+    memcpy (cache[cache_id].buffer, buffer, BLOCK_SECTOR_SIZE);
+    // only the cached copy is dirtied; it reaches the disk when it's
+    // evicted or flushed
+    cache_release (cache_id, true, true);
+}
+
+/* Pins the cache of SECTOR_ID, shared for reading or exclusive if
+   WRITE, so its data can be used in place through cache_data()
+   without a copy. Returns the cache index to pass to cache_put(). */
+int cache_get (block_sector_t sector_id, bool write)
+{
+    return cache_acquire (sector_id, write, true);
+}
+
+/* Returns the data of the cache CACHE_ID held by cache_get(). */
+void *cache_data (int cache_id)
+{
+    ASSERT (cache[cache_id].pin_cnt > 0);
+    return cache[cache_id].buffer;
+}
+
+/* Releases the cache CACHE_ID held by cache_get(), marking it dirty
+   if DIRTY. A writer is the only holder while it has the cache, so
+   the writing flag tells which way it was held. */
+void cache_put (int cache_id, bool dirty)
+{
+    cache_release (cache_id, cache[cache_id].writing, dirty);
+}
+
+/* Finds or loads the cache of SECTOR_ID and holds it, EXCLUSIVE for
+   writing or shared for reading. On a miss the sector is read from
+   disk only if NEED_READ. Only the index lookup runs under
+   cache_big_lock, so hits on other sectors go on while a miss waits
+   for the disk. Returns the cache index, to be passed to
+   cache_release(). */
+int cache_acquire (block_sector_t sector_id, bool exclusive, bool need_read)
+{
+    struct cache_sector *c;
+    int cache_id;
+
+    cache_lock_index ();
+    while (true){
+        cache_id = find_sector (sector_id);
+        if (cache_id != -1){
+            // sector_id is in cache currently!
+            c = &cache[cache_id];
+            c->pin_cnt++;
+            cache_counts.hits++;
+            if (c->prefetched){
+                c->prefetched = false;
+                cache_counts.read_ahead_hits++;
+            }
+            cache_touch (cache_id);
+            lock_release(&cache_big_lock);
+            cache_lock_slot (cache_id, exclusive);
+            return cache_id;
+        }
         // not found this sector in cache: fetch it from disk
-        int cache_id = fetch_free_cache ();
-        cache[cache_id].sector_id = sector_id;
-        cache[cache_id].dirty == false;
-        cache[cache_id].used = true;
-        cache[cache_id].accessed = 1;
-        // read block into cache
-        block_read (fs_device, sector_id, cache[cache_id].buffer);
-        // read block from cache
-        memcpy (buffer, cache[cache_id].buffer, BLOCK_SECTOR_SIZE);
+        cache_id = fetch_free_cache ();
+        if (cache_id != -1)
+            break;
+        // the index changed while fetch_free_cache() slept, look again
     }
+
+    // nobody can reach this cache until it's inserted into the index,
+    // so it's safe to set it up without its cache_lock
+    c = &cache[cache_id];
+    c->sector_id = sector_id;
+    c->used = true;
+    c->dirty = false;
+    c->accessed = 1;
+    c->prefetched = false;
+    c->pin_cnt = 1;
+    c->loading = true;
+    cache_hash_insert (cache_id);
+    cache_admit (cache_id);
+    cache_used_cnt++;
+    cache_counts.misses++;
     lock_release(&cache_big_lock);
-    // block_read (fs_device, sector_id, buffer);
+
+    // read block into cache; others asking for it wait on loading
+    if (need_read)
+        block_read (fs_device, sector_id, c->buffer);
+
+    lock_acquire (&c->cache_lock);
+    c->loading = false;
+    if (exclusive)
+        c->writing = true;
+    else
+        c->readers++;
+    cond_broadcast (&c->cache_cond, &c->cache_lock);
+    lock_release (&c->cache_lock);
+    return cache_id;
 }
 
-void cache_write (block_sector_t sector_id, void *buffer)
+/* Releases a cache held by cache_acquire() with the same EXCLUSIVE,
+   marking it dirty if DIRTY. */
+void cache_release (int cache_id, bool exclusive, bool dirty)
 {
-    lock_acquire(&cache_big_lock);
-    int cache_id = find_sector (sector_id);
-    if (cache_id != -1){
-        // sector_id is in cache currently!
-        increase_accessed(cache_id);
-        // write buffer to cache
-        memcpy (cache[cache_id].buffer, buffer, BLOCK_SECTOR_SIZE);
-        cache[cache_id].dirty = true;
+    struct cache_sector *c = &cache[cache_id];
+
+    lock_acquire (&c->cache_lock);
+    if (exclusive){
+        ASSERT (c->writing);
+        c->writing = false;
+        if (dirty)
+            c->dirty = true;
     }
     else {
-        // not found this sector in cache: fetch it from disk
-        int cache_id = fetch_free_cache ();
-        // question: why can't I acquire that lock ?!
-        cache[cache_id].sector_id = sector_id;
-        cache[cache_id].used = true;
-        cache[cache_id].dirty = true;
-        cache[cache_id].accessed = 1;
-        // write buffer to cache
-        memcpy (cache[cache_id].buffer, buffer, BLOCK_SECTOR_SIZE);
+        ASSERT (c->readers > 0);
+        c->readers--;
+    }
+    cond_broadcast (&c->cache_cond, &c->cache_lock);
+    lock_release (&c->cache_lock);
+
+    cache_lock_index ();
+    if (exclusive && dirty){
+        cache_counts.writes++;
+        cache_dirty_enqueue (cache_id);
     }
+    if (--c->pin_cnt == 0)
+        cond_signal (&cache_free_cond, &cache_big_lock);
+    if (exclusive && dirty)
+        cache_throttle ();
     lock_release(&cache_big_lock);
-    block_write (fs_device, sector_id, buffer);
 }
 
+/* Queues the cache CACHE_ID, just dirtied, for write-behind unless
+   it's queued already, and wakes the write-behind thread if this is
+   the first dirty cache or dirty caches passed the background
+   ratio. */
+void cache_dirty_enqueue (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (c->dirty_queued)
+        return;
+    c->dirty_queued = true;
+    c->dirty_since = timer_ticks ();
+    list_push_back (&cache_dirty_list, &c->dirty_elem);
+    cache_dirty_cnt++;
+    if (cache_dirty_cnt == 1)
+        cond_signal (&cache_flush_cond, &cache_big_lock);
+    else if (cache_dirty_cnt * 100 > cache_slot_cnt * CACHE_DIRTY_BACKGROUND)
+        cache_flush_kick = true;
+}
+
+/* Takes the cache CACHE_ID off cache_dirty_list if it's there,
+   because it's about to be written back. */
+void cache_dirty_dequeue (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (!c->dirty_queued)
+        return;
+    c->dirty_queued = false;
+    list_remove (&c->dirty_elem);
+    cache_dirty_cnt--;
+}
+
+/* Makes a writer wait while dirty caches, counting those being
+   written back, are over the high-water mark, so that writers
+   can't dirty the cache faster than the disk takes it. */
+void cache_throttle (void)
+{
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    // the write-behind thread dirties caches too, flushing the free
+    // map, and would only be waiting for itself
+    if (thread_current ()->tid == write_behind_tid)
+        return;
+    while ((cache_dirty_cnt + cache_writeback_cnt) * 100
+           > cache_slot_cnt * CACHE_DIRTY_HIGH){
+        cache_flush_kick = true;
+        cond_signal (&cache_flush_cond, &cache_big_lock);
+        cond_wait (&cache_clean_cond, &cache_big_lock);
+    }
+}
+
+/* Waits until the pinned cache CACHE_ID is loaded and free for
+   EXCLUSIVE (writer) or shared (reader) access, then takes it. */
+void cache_lock_slot (int cache_id, bool exclusive)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (c->pin_cnt > 0);
+    lock_acquire (&c->cache_lock);
+    if (exclusive){
+        while (c->loading || c->writing || c->readers > 0)
+            cond_wait (&c->cache_cond, &c->cache_lock);
+        c->writing = true;
+    }
+    else {
+        while (c->loading || c->writing)
+            cond_wait (&c->cache_cond, &c->cache_lock);
+        c->readers++;
+    }
+    lock_release (&c->cache_lock);
+}
+
+/* Writes the pinned cache CACHE_ID back to disk if it's dirty, and
+   returns whether it did. Holds it shared meanwhile, so writers
+   can't slip a change in between the write and clearing the dirty
+   bit. */
+bool cache_flush_slot (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+    bool written = false;
+
+    cache_lock_slot (cache_id, false);
+    if (c->dirty){
+        block_write (fs_device, c->sector_id, c->buffer);
+        c->dirty = false;
+        written = true;
+    }
+    lock_acquire (&c->cache_lock);
+    c->readers--;
+    cond_broadcast (&c->cache_cond, &c->cache_lock);
+    lock_release (&c->cache_lock);
+    return written;
+}
+
+/* Writes back the CNT pinned caches IDS, which hold consecutive
+   sectors, with a single block_write_multiple() through a bounce
+   buffer, and sets WRITTEN[i] if IDS[i] was dirty. Holds them all
+   shared meanwhile. Writes them one by one if there's only one or no
+   memory for the bounce buffer. */
+void cache_flush_run (const int *ids, size_t cnt, bool *written)
+{
+    unsigned char *bounce = NULL;
+
+    if (cnt > 1)
+        bounce = malloc (cnt * BLOCK_SECTOR_SIZE);
+    if (bounce == NULL){
+        for (size_t i = 0; i < cnt; i ++)
+            written[i] = cache_flush_slot (ids[i]);
+        return;
+    }
+
+    for (size_t i = 0; i < cnt; i ++){
+        struct cache_sector *c = &cache[ids[i]];
+        cache_lock_slot (ids[i], false);
+        memcpy (bounce + i * BLOCK_SECTOR_SIZE, c->buffer, BLOCK_SECTOR_SIZE);
+        written[i] = c->dirty;
+    }
+    block_write_multiple (fs_device, cache[ids[0]].sector_id, cnt, bounce);
+    for (size_t i = 0; i < cnt; i ++){
+        struct cache_sector *c = &cache[ids[i]];
+        c->dirty = false;
+        lock_acquire (&c->cache_lock);
+        c->readers--;
+        cond_broadcast (&c->cache_cond, &c->cache_lock);
+        lock_release (&c->cache_lock);
+    }
+    free (bounce);
+}
+
+/* Writes every dirty cache back to disk, in sorted batches. The
+   caches stay resident, now clean. */
 void cache_back_to_disk ()
 {
-    lock_acquire(&cache_big_lock);
-    for (int i = 0; i < 64; ++i) {
-        if (cache[i].used == true && cache[i].dirty == true){
-            // write back all the dirty caches
-            block_write (fs_device, cache[i].sector_id, cache[i].buffer);
-            cache[i].used = false;
-            cache[i].dirty = false;
+    // the free map goes into the cache first, to reach the disk along
+    // with what uses the sectors it hands out
+    free_map_flush (true);
+    cache_lock_index ();
+    // only what is dirty now, so busy writers can't keep this going
+    size_t left = cache_dirty_cnt;
+    while (left > 0){
+        size_t flushed = cache_flush_batch (left, true);
+        if (flushed == 0)
+            break;
+        left -= flushed;
+    }
+    lock_release(&cache_big_lock);
+}
+
+/* Writes back up to MAX dirty caches, oldest first, in one batch
+   sorted by sector number so the disk head sweeps across them once.
+   Unless ALL, only takes caches while cache_flush_due(). The caches
+   stay resident and pinned meanwhile, and cache_big_lock is dropped
+   for the writes. Returns how many caches were taken. */
+size_t cache_flush_batch (size_t max, bool all)
+{
+    int batch[CACHE_FLUSH_BATCH];
+    size_t cnt = 0;
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (max > CACHE_FLUSH_BATCH)
+        max = CACHE_FLUSH_BATCH;
+    while (cnt < max && !list_empty (&cache_dirty_list)
+           && (all || cache_flush_due ())){
+        struct cache_sector *c = list_entry (list_front (&cache_dirty_list),
+                                             struct cache_sector, dirty_elem);
+        int cache_id = c - cache;
+        cache_dirty_dequeue (cache_id);
+        c->pin_cnt++;
+        batch[cnt++] = cache_id;
+    }
+    if (cnt == 0)
+        return 0;
+    cache_writeback_cnt += cnt;
+    qsort (batch, cnt, sizeof *batch, cache_sector_less);
+
+    lock_release(&cache_big_lock);
+    // each run of consecutive sectors goes to disk in one command
+    bool written[CACHE_FLUSH_BATCH];
+    for (size_t i = 0; i < cnt; ){
+        size_t run = 1;
+        while (i + run < cnt && cache[batch[i + run]].sector_id
+                                == cache[batch[i]].sector_id + run)
+            run++;
+        cache_flush_run (batch + i, run, written + i);
+        i += run;
+    }
+    cache_lock_index ();
+
+    if (!all)
+        cache_counts.flush_batches++;
+    for (size_t i = 0; i < cnt; i ++){
+        if (written[i]){
+            cache_counts.disk_writes++;
+            if (!all)
+                cache_counts.flushes++;
         }
+        if (--cache[batch[i]].pin_cnt == 0)
+            cond_signal (&cache_free_cond, &cache_big_lock);
     }
+    cache_writeback_cnt -= cnt;
+    cond_broadcast (&cache_clean_cond, &cache_big_lock);
+    return cnt;
+}
+
+/* Returns whether the write-behind thread should write back now:
+   dirty caches are over the background ratio, or the oldest has been
+   dirty too long. */
+bool cache_flush_due (void)
+{
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (list_empty (&cache_dirty_list))
+        return false;
+    if (cache_dirty_cnt * 100 > cache_slot_cnt * CACHE_DIRTY_BACKGROUND)
+        return true;
+    struct cache_sector *oldest = list_entry (list_front (&cache_dirty_list),
+                                              struct cache_sector, dirty_elem);
+    return timer_elapsed (oldest->dirty_since) >= CACHE_DIRTY_EXPIRE;
+}
+
+/* Orders cache indexes, pointed to by A and B, by sector number. */
+int cache_sector_less (const void *a, const void *b)
+{
+    block_sector_t sa = cache[*(const int *) a].sector_id;
+    block_sector_t sb = cache[*(const int *) b].sector_id;
+    return sa < sb ? -1 : sa > sb;
+}
+
+/* Writes the pinned cache CACHE_ID back to disk if it's dirty, for
+   eviction or shrinking. Must be called with cache_big_lock held; it
+   is dropped for the write. */
+void cache_writeback (int cache_id)
+{
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    ASSERT (cache[cache_id].pin_cnt > 0);
+    cache_dirty_dequeue (cache_id);
+    cache_writeback_cnt++;
     lock_release(&cache_big_lock);
+    bool written = cache_flush_slot (cache_id);
+    cache_lock_index ();
+    if (written)
+        cache_counts.disk_writes++;
+    cache_writeback_cnt--;
+    cond_broadcast (&cache_clean_cond, &cache_big_lock);
+}
+
+/* Acquires cache_big_lock, counting the times and TSC cycles spent
+   waiting for it. A wait is nearly always far shorter than a timer
+   tick, so ticks would count it as nothing. */
+void cache_lock_index (void)
+{
+    if (lock_try_acquire (&cache_big_lock))
+        return;
+    uint64_t start = rdtsc ();
+    lock_acquire (&cache_big_lock);
+    cache_counts.lock_waits++;
+    cache_counts.lock_wait_cycles += rdtsc () - start;
+}
+
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t rdtsc (void)
+{
+    uint64_t tsc;
+    asm volatile ("rdtsc" : "=A" (tsc));
+    return tsc;
 }
 
 int find_sector (block_sector_t sector_id)
 {
-    for (int i = 0; i < 64; i ++){
-        if (cache[i].used == true && cache[i].sector_id == sector_id){
-            return i;
+    struct list *bucket = cache_bucket (sector_id);
+    for (struct list_elem *e = list_begin (bucket); e != list_end (bucket);
+         e = list_next (e)){
+        struct cache_sector *c = list_entry (e, struct cache_sector,
+                                             hash_elem);
+        if (c->sector_id == sector_id){
+            return c - cache;
         }
     }
     // not found
     return -1;
 }
 
+struct list *cache_bucket (block_sector_t sector_id)
+{
+    return &cache_hash[hash_int (sector_id) & (cache_hash_buckets - 1)];
+}
+
+void cache_hash_insert (int cache_id)
+{
+    ASSERT (cache[cache_id].used);
+    list_push_front (cache_bucket (cache[cache_id].sector_id),
+                     &cache[cache_id].hash_elem);
+}
+
+void cache_hash_remove (int cache_id)
+{
+    ASSERT (cache[cache_id].used);
+    list_remove (&cache[cache_id].hash_elem);
+}
+
 int fetch_free_cache ()
 {
-    // use clock to find a cache entry to evict
-    while (true)
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (!list_empty (&cache_free_list))
+        return list_entry (list_pop_front (&cache_free_list),
+                           struct cache_sector, queue_elem) - cache;
+
+    int victim = cache_policy == CACHE_POLICY_2Q ? cache_2q_victim (false)
+                                                 : cache_clock_victim ();
+    if (victim == -1){
+        // every cache is pinned: take another page if there is one,
+        // else wait for a cache to be released
+        if (cache_grow ())
+            return list_entry (list_pop_front (&cache_free_list),
+                               struct cache_sector, queue_elem) - cache;
+        cond_wait (&cache_free_cond, &cache_big_lock);
+        return -1;
+    }
+    struct cache_sector *c = &cache[victim];
+    if (c->dirty == true){
+        // write it back without holding the index lock, then free it
+        // unless someone started using it meanwhile. Either way the
+        // caller must look its sector up again afterwards
+        c->pin_cnt++;
+        cache_writeback (victim);
+        if (--c->pin_cnt == 0){
+            if (c->used && !c->dirty){
+                cache_drop (victim);
+                // if cache_shrink() is retiring its page meanwhile, it
+                // lists or frees the entry itself
+                if (victim < (int) cache_slot_cnt)
+                    list_push_back (&cache_free_list, &c->queue_elem);
+                cache_counts.dirty_evictions++;
+            }
+            cond_signal (&cache_free_cond, &cache_big_lock);
+        }
+        return -1;
+    }
+    cache_drop (victim);
+    cache_counts.clean_evictions++;
+    return victim;
+}
+
+/* Runs the clock over the used caches, skipping pinned ones and
+   clearing accessed bits, and returns the first cache found with its
+   bit clear, or -1 if every cache is pinned. */
+int cache_clock_victim (void)
+{
+    for (size_t scanned = 0; scanned < 2 * cache_slot_cnt; scanned ++)
     {
-        if (cache[cache_cur].used == false) {
-            int temp = cache_cur;
-            cache_cur = (cache_cur + 1) % 64;
-            return temp;
+        if (cache_cur >= (int) cache_slot_cnt)
+            cache_cur = 0;
+        struct cache_sector *c = &cache[cache_cur];
+        int temp = cache_cur;
+        cache_cur = (cache_cur + 1) % cache_slot_cnt;
+
+        if (c->used == false || c->pin_cnt > 0)
+            continue;
+        if (c->accessed != 0){
+            c->accessed = 0;
+            continue;
+        }
+        return temp;
+    }
+    return -1;
+}
+
+/* Picks the 2Q victim: the oldest unpinned cache of cache_a1in if it
+   holds more than its quarter of the cache, else the least recently
+   used unpinned one of cache_am, falling back to the other queue if
+   that one has none. For PREFETCH, only a clean cache of cache_a1in
+   will do, so that speculative reads never push out hot sectors.
+   Returns -1 if no cache qualifies. */
+int cache_2q_victim (bool prefetch)
+{
+    if (prefetch)
+        return cache_queue_victim (&cache_a1in, true);
+
+    int victim;
+    if (cache_a1in_cnt > cache_slot_cnt / 4){
+        victim = cache_queue_victim (&cache_a1in, false);
+        if (victim == -1)
+            victim = cache_queue_victim (&cache_am, false);
+    }
+    else {
+        victim = cache_queue_victim (&cache_am, false);
+        if (victim == -1)
+            victim = cache_queue_victim (&cache_a1in, false);
+    }
+    return victim;
+}
+
+/* Returns the unpinned cache nearest the back of the 2Q queue QUEUE,
+   only a clean one if CLEAN_ONLY, or -1 if there is none. Pinned
+   caches are few, so this rarely looks past the last entry. Entries
+   past cache_slot_cnt are being retired by cache_shrink() and never
+   qualify. */
+int cache_queue_victim (struct list *queue, bool clean_only)
+{
+    for (struct list_elem *e = list_rbegin (queue); e != list_rend (queue);
+         e = list_prev (e)){
+        struct cache_sector *c = list_entry (e, struct cache_sector,
+                                             queue_elem);
+        if (c - cache >= (int) cache_slot_cnt)
+            continue;
+        if (c->pin_cnt == 0 && (!clean_only || !c->dirty))
+            return c - cache;
+    }
+    return -1;
+}
+
+/* Records an access to the used cache CACHE_ID: sets its accessed
+   bit and, under 2Q, moves it to the front of cache_am if it's
+   there. A sector in cache_a1in stays put, since accesses close
+   together say nothing about whether it's hot, and so does one being
+   retired by cache_shrink(). */
+void cache_touch (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    c->accessed = 1;
+    if (cache_policy == CACHE_POLICY_2Q && c->hot
+        && cache_id < (int) cache_slot_cnt){
+        list_remove (&c->queue_elem);
+        list_push_front (&cache_am, &c->queue_elem);
+    }
+}
+
+/* Queues the cache CACHE_ID, just loaded with its sector, for
+   replacement. Under 2Q it goes to cache_am if it's being read and
+   was remembered in cache_a1out, else to cache_a1in. */
+void cache_admit (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (cache_policy != CACHE_POLICY_2Q)
+        return;
+    c->hot = c->accessed && cache_ghost_forget (c->sector_id);
+    if (c->hot)
+        list_push_front (&cache_am, &c->queue_elem);
+    else {
+        list_push_front (&cache_a1in, &c->queue_elem);
+        cache_a1in_cnt++;
+    }
+}
+
+/* Takes the used cache CACHE_ID out of the sector index and the 2Q
+   queues, leaving it unused. A sector leaving cache_a1in is
+   remembered in cache_a1out if it was actually read. */
+void cache_drop (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    cache_hash_remove (cache_id);
+    c->used = false;
+    cache_used_cnt--;
+    if (c->prefetched){
+        c->prefetched = false;
+        cache_counts.read_ahead_wasted++;
+    }
+    if (cache_policy == CACHE_POLICY_2Q){
+        list_remove (&c->queue_elem);
+        if (!c->hot){
+            cache_a1in_cnt--;
+            if (c->accessed)
+                cache_ghost_remember (c->sector_id);
+        }
+    }
+}
+
+/* Remembers SECTOR_ID at the front of cache_a1out, forgetting the
+   oldest ghosts to keep it to half as many as there are caches. */
+void cache_ghost_remember (block_sector_t sector_id)
+{
+    size_t limit = cache_slot_cnt / 2;
+
+    while (cache_a1out_cnt > 0 && cache_a1out_cnt >= limit){
+        struct cache_ghost *old = list_entry (list_pop_back (&cache_a1out),
+                                              struct cache_ghost, ghost_elem);
+        list_remove (&old->hash_elem);
+        list_push_back (&cache_ghost_free, &old->ghost_elem);
+        cache_a1out_cnt--;
+    }
+    if (limit == 0 || list_empty (&cache_ghost_free))
+        return;
+    struct cache_ghost *g = list_entry (list_pop_front (&cache_ghost_free),
+                                        struct cache_ghost, ghost_elem);
+    g->sector_id = sector_id;
+    list_push_front (&cache_a1out, &g->ghost_elem);
+    list_push_front (cache_ghost_bucket (sector_id), &g->hash_elem);
+    cache_a1out_cnt++;
+}
+
+/* Forgets SECTOR_ID if it's in cache_a1out, and returns whether it
+   was. */
+bool cache_ghost_forget (block_sector_t sector_id)
+{
+    struct list *bucket = cache_ghost_bucket (sector_id);
+    for (struct list_elem *e = list_begin (bucket); e != list_end (bucket);
+         e = list_next (e)){
+        struct cache_ghost *g = list_entry (e, struct cache_ghost, hash_elem);
+        if (g->sector_id == sector_id){
+            list_remove (&g->hash_elem);
+            list_remove (&g->ghost_elem);
+            list_push_back (&cache_ghost_free, &g->ghost_elem);
+            cache_a1out_cnt--;
+            return true;
+        }
+    }
+    return false;
+}
+
+struct list *cache_ghost_bucket (block_sector_t sector_id)
+{
+    return &cache_ghost_hash[hash_int (sector_id) & (cache_hash_buckets - 1)];
+}
+
+/* Like fetch_free_cache(), but for prefetching: only takes a cache
+   that is free, or clean, unpinned and not recently accessed, and
+   leaves the clock's accessed bits alone. Never sleeps or grows the
+   cache, so prefetch never waits behind or writes back for demand
+   misses, nor takes pages for them. Returns -1 if there is no such
+   cache. */
+int fetch_clean_cache (void)
+{
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (!list_empty (&cache_free_list))
+        return list_entry (list_pop_front (&cache_free_list),
+                           struct cache_sector, queue_elem) - cache;
+
+    int victim = -1;
+    if (cache_policy == CACHE_POLICY_2Q)
+        victim = cache_2q_victim (true);
+    else
+        for (size_t scanned = 0; scanned < cache_slot_cnt; scanned ++)
+        {
+            int i = (cache_cur + scanned) % cache_slot_cnt;
+            struct cache_sector *c = &cache[i];
+
+            if (c->used && c->pin_cnt == 0 && c->accessed == 0
+                && c->dirty == false){
+                victim = i;
+                break;
+            }
         }
-        if (cache[cache_cur].accessed == 0){
-            if (cache[cache_cur].dirty == true)
-                block_write (fs_device, cache[cache_cur].sector_id, 
-                                cache[cache_cur].buffer);
-            cache[cache_cur].used = false;
-            int temp = cache_cur;
-            cache_cur = (cache_cur + 1) % 64;
-            return temp;
+    if (victim != -1){
+        cache_drop (victim);
+        cache_counts.clean_evictions++;
+    }
+    return victim;
+}
+
+/* Loads SECTOR_ID into the cache if it isn't there already and a
+   cache can be had without evicting anything useful. Only queues the
+   read, so the read-ahead thread can queue the next one and the block
+   layer can merge them; cache_prefetch_done() finishes the job. */
+void cache_prefetch (block_sector_t sector_id)
+{
+    cache_lock_index ();
+    int cache_id = find_sector (sector_id);
+    if (cache_id == -1)
+        cache_id = fetch_clean_cache ();
+    else
+        // the sector is already in the cache
+        cache_id = -1;
+    if (cache_id == -1){
+        lock_release(&cache_big_lock);
+        return;
+    }
+
+    struct cache_sector *c = &cache[cache_id];
+    c->sector_id = sector_id;
+    c->used = true;
+    c->dirty = false;
+    // not accessed: it goes first if nobody turns out to read it
+    c->accessed = 0;
+    c->prefetched = true;
+    c->pin_cnt = 1;
+    c->loading = true;
+    cache_hash_insert (cache_id);
+    cache_admit (cache_id);
+    cache_used_cnt++;
+    lock_release(&cache_big_lock);
+
+    struct block_request *r = malloc (sizeof *r);
+    if (r == NULL){
+        // no memory to queue it: read it right here instead
+        block_read (fs_device, sector_id, c->buffer);
+        cache_prefetch_finish (cache_id);
+        return;
+    }
+    block_request_init (r, false, sector_id, 1, c->buffer);
+    r->complete = cache_prefetch_done;
+    r->aux = c;
+    block_submit (fs_device, r);
+}
+
+/* Completion hook for the read R queued by cache_prefetch(). Runs in
+   the block dispatcher thread, which only ever waits here for short
+   critical sections. */
+void cache_prefetch_done (struct block_request *r)
+{
+    struct cache_sector *c = r->aux;
+    free (r);
+    cache_prefetch_finish (c - cache);
+}
+
+/* Lets readers at prefetched cache CACHE_ID, now loaded, and unpins
+   it. */
+void cache_prefetch_finish (int cache_id)
+{
+    struct cache_sector *c = &cache[cache_id];
+
+    lock_acquire (&c->cache_lock);
+    c->loading = false;
+    cond_broadcast (&c->cache_cond, &c->cache_lock);
+    lock_release (&c->cache_lock);
+
+    cache_lock_index ();
+    if (--c->pin_cnt == 0)
+        cond_signal (&cache_free_cond, &cache_big_lock);
+    lock_release(&cache_big_lock);
+}
+
+/* Asks the read-ahead thread to bring SECTOR_ID into the cache.
+   Doesn't wait for it; if the queue is full the request is dropped. */
+void cache_read_ahead (block_sector_t sector_id)
+{
+    lock_acquire (&read_ahead_lock);
+    if (read_ahead_cnt < READ_AHEAD_QUEUE_MAX){
+        struct read_ahead_sector *ras = 
+                 malloc (sizeof (struct read_ahead_sector));
+        if (ras != NULL){
+            ras->sector_id = sector_id;
+            list_push_back (&read_ahead_list, &ras->read_ahead_elem);
+            read_ahead_cnt++;
+            cond_signal (&read_ahead_condition, &read_ahead_lock);
         }
-        cache[cache_cur].accessed = 0;
-        cache_cur = (cache_cur + 1) % 64;
     }
+    lock_release (&read_ahead_lock);
+}
+
+/* Adds a page of buffers to the end of the cache, unless the cache
+   is already at cache_max entries or being shrunk. The page comes
+   from the user pool, so user processes short of memory can claim it
+   back with cache_shrink(). Returns whether the cache grew. */
+bool cache_grow (void)
+{
+    ASSERT (lock_held_by_current_thread (&cache_big_lock));
+    if (cache_slot_cnt >= cache_max || cache_shrinking)
+        return false;
+    unsigned char *page = palloc_get_page (PAL_USER);
+    if (page == NULL)
+        return false;
+    for (size_t i = 0; i < CACHE_PER_PAGE; i ++){
+        struct cache_sector *c = &cache[cache_slot_cnt + i];
+        c->buffer = page + i * BLOCK_SECTOR_SIZE;
+        c->used = false;
+        list_push_back (&cache_free_list, &c->queue_elem);
+    }
+    cache_slot_cnt += CACHE_PER_PAGE;
+    return true;
 }
 
-void increase_accessed (int cache_operating)
+/* Gives the last page of buffers back to palloc, writing back any
+   dirty sector in it first. Fails if the cache is down to one page
+   or one of the page's entries is in use. Returns whether a page was
+   freed. While it runs, the page's entries are past cache_slot_cnt
+   and off the free list and 2Q queues, so nobody else hands them
+   out. */
+bool cache_shrink (void)
 {
-    for (int i = 0; i < 64; i ++){
-        if (cache[i].used == true)
-            cache[i].accessed += 1;
+    cache_lock_index ();
+    if (cache_slot_cnt <= CACHE_PER_PAGE || cache_shrinking){
+        lock_release(&cache_big_lock);
+        return false;
+    }
+    // stop handing out the last page's entries, then write them back
+    cache_shrinking = true;
+    size_t first = cache_slot_cnt - CACHE_PER_PAGE;
+    cache_slot_cnt = first;
+    for (size_t i = first; i < first + CACHE_PER_PAGE; i ++){
+        struct cache_sector *c = &cache[i];
+        if (!c->used)
+            list_remove (&c->queue_elem);
+        else if (cache_policy == CACHE_POLICY_2Q){
+            list_remove (&c->queue_elem);
+            list_push_back (&cache_retiring, &c->queue_elem);
+        }
+    }
+    for (size_t i = first; i < first + CACHE_PER_PAGE; i ++){
+        struct cache_sector *c = &cache[i];
+        if (c->used && c->dirty && c->pin_cnt == 0){
+            c->pin_cnt++;
+            cache_writeback (i);
+            if (--c->pin_cnt == 0)
+                cond_signal (&cache_free_cond, &cache_big_lock);
+        }
+    }
+
+    bool success = true;
+    for (size_t i = first; i < first + CACHE_PER_PAGE; i ++)
+        if (cache[i].used && (cache[i].pin_cnt > 0 || cache[i].dirty))
+            success = false;
+    void *page = cache[first].buffer;
+    if (success){
+        for (size_t i = first; i < first + CACHE_PER_PAGE; i ++){
+            if (cache[i].used)
+                cache_drop (i);
+            cache[i].buffer = NULL;
+        }
     }
-    // refresh the cache we are currently reading or writing
-    cache[cache_operating].accessed = 0;
+    else {
+        // someone is still using it: keep the page after all, and
+        // queue its used entries again as the oldest of their queues
+        for (size_t i = first; i < first + CACHE_PER_PAGE; i ++){
+            struct cache_sector *c = &cache[i];
+            if (!c->used)
+                list_push_back (&cache_free_list, &c->queue_elem);
+            else if (cache_policy == CACHE_POLICY_2Q){
+                list_remove (&c->queue_elem);
+                list_push_back (c->hot ? &cache_am : &cache_a1in,
+                                &c->queue_elem);
+            }
+        }
+        cache_slot_cnt = first + CACHE_PER_PAGE;
+    }
+    cache_shrinking = false;
+    lock_release(&cache_big_lock);
+
+    if (success)
+        palloc_free_page (page);
+    return success;
+}
+
+/* Copies the cache counters into STATS. */
+void cache_get_stats (struct cache_stats *stats)
+{
+    cache_lock_index ();
+    *stats = cache_counts;
+    lock_release(&cache_big_lock);
+}
+
+/* Prints the cache size and hit rate, how many sector writes the
+   cache absorbed, and the eviction, write-behind, read-ahead and
+   index lock counters. */
+void cache_print_stats (void)
+{
+    struct cache_stats st;
+
+    cache_get_stats (&st);
+    unsigned long long lookups = st.hits + st.misses;
+    printf ("Cache: %zu of %zu sectors at boot, %s policy, %llu hits, "
+            "%llu misses, %llu%% hit rate\n", cache_slot_cnt, cache_size,
+            cache_policy == CACHE_POLICY_2Q ? "2q" : "clock",
+            st.hits, st.misses, lookups > 0 ? st.hits * 100 / lookups : 0);
+    printf ("Cache: %llu sector writes, %llu written to disk, "
+            "%llu saved\n", st.writes, st.disk_writes,
+            st.writes > st.disk_writes ? st.writes - st.disk_writes : 0);
+    printf ("Cache: %llu clean and %llu dirty evictions, %llu sectors "
+            "written behind in %llu batches\n", st.clean_evictions,
+            st.dirty_evictions, st.flushes, st.flush_batches);
+    printf ("Cache: %llu read-ahead hits, %llu wasted prefetches\n",
+            st.read_ahead_hits, st.read_ahead_wasted);
+    printf ("Cache: waited for the index lock %llu times, %llu cycles\n",
+            st.lock_waits, st.lock_wait_cycles);
 }
 
 /* advanced */
 
 void write_behind ()
 {
-    thread_create ("write_behind_t", PRI_DEFAULT, write_behind_func, NULL);
+    write_behind_tid = thread_create ("write_behind_t", PRI_DEFAULT,
+                                      write_behind_func, NULL);
 }
 
-void write_behind_func ()
+/* Writes dirty caches back in sorted batches whenever one has been
+   dirty for CACHE_DIRTY_EXPIRE ticks or too much of the cache is
+   dirty, rather than on a fixed period. Sleeps for as long as nothing
+   is dirty. */
+void write_behind_func (void *aux UNUSED)
 {
+    cache_lock_index ();
     while (true){
-        // flush back every 0.5s
-        timer_msleep (500);
-        cache_back_to_disk ();
+        while (list_empty (&cache_dirty_list))
+            cond_wait (&cache_flush_cond, &cache_big_lock);
+        if (cache_flush_due ()){
+            lock_release(&cache_big_lock);
+            free_map_flush (false);
+            cache_lock_index ();
+            cache_flush_batch (CACHE_FLUSH_BATCH, false);
+            continue;
+        }
+
+        // sleep until the oldest dirty cache expires, a slice at a
+        // time, waking early if writers pass the background ratio
+        struct cache_sector *oldest = list_entry (
+                list_front (&cache_dirty_list), struct cache_sector,
+                dirty_elem);
+        int64_t wait = CACHE_DIRTY_EXPIRE - timer_elapsed (oldest->dirty_since);
+        cache_flush_kick = false;
+        lock_release(&cache_big_lock);
+        int64_t start = timer_ticks ();
+        while (!cache_flush_kick && timer_elapsed (start) < wait)
+            timer_sleep (CACHE_FLUSH_SLICE);
+        cache_lock_index ();
     }
 }
 
 void read_ahead ()
 {
-    // thread_create ("read_ahead_t", PRI_MIN, read_ahead_func, NULL);
+    thread_create ("read_ahead_t", PRI_DEFAULT, read_ahead_func, NULL);
 }
 
-/*
-void read_ahead_func (){
+void read_ahead_func (void *aux UNUSED)
+{
     while (true){
         lock_acquire (&read_ahead_lock);
         while (list_empty (&read_ahead_list)){
@@ -229,30 +1292,11 @@ void read_ahead_func (){
         struct read_ahead_sector *ra_block = 
             list_entry (list_pop_front (&read_ahead_list),
              struct read_ahead_sector, read_ahead_elem);
+        read_ahead_cnt--;
         block_sector_t sector_id = ra_block->sector_id;
         lock_release (&read_ahead_lock);
 
-        // lock_acquire (&cache_big_lock);
-        int cache_id = find_sector (sector_id);
-        if (cache_id != -1){
-            // the next sector is already in the cache
-            // we don't need to do anything
-        }
-        else
-        {
-            int cache_id = fetch_free_cache ();
-            // lock_acquire(&cache[cache_id].cache_lock);
-            cache[cache_id].sector_id = sector_id;
-            cache[cache_id].dirty == false;
-            cache[cache_id].used = true;
-            cache[cache_id].accessed = 1;
-            // read block into cache
-            block_read (fs_device, sector_id, cache[cache_id].buffer);
-            // no need to read block from cache !
-            // lock_release(&cache[cache_id].cache_lock);
-        }
-        // lock_release (&cache_big_lock);
+        cache_prefetch (sector_id);
         free (ra_block);
     }
 }
-*/
\ No newline at end of file
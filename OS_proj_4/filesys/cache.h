@@ -1,4 +1,13 @@
 #include "devices/block.h"
+#include <list.h>
+#include <cache-stats.h>
+
+// set the sectors the cache holds from boot. Call before cache_init()
+void cache_configure (size_t sectors);
+
+// set the replacement policy, "clock" or "2q". Call before
+// cache_init(). Returns false if NAME is unknown
+bool cache_set_policy (const char *name);
 
 // init cache
 void cache_init ();
@@ -6,31 +15,152 @@ void cache_init ();
 // find and read the cache corresponding to SECTOR_ID to BUFFER
 void cache_read (block_sector_t sector_id, void *buffer);
 
-// find and write the BUFFER to cache corresponding to SECTOR_ID
+// find and write the BUFFER to cache corresponding to SECTOR_ID.
+// Write-back: the disk copy is only updated on eviction or flush
 void cache_write (block_sector_t sector_id, void *buffer);
 
-// flush all cache back to disk
+// pin the cache of SECTOR_ID for reading, or exclusively for WRITE,
+// without copying it. Returns the cache index for cache_data() and
+// cache_put()
+int cache_get (block_sector_t sector_id, bool write);
+
+// the BLOCK_SECTOR_SIZE bytes of the cache CACHE_ID, valid until cache_put()
+void *cache_data (int cache_id);
+
+// release a cache got from cache_get(), marking it dirty if DIRTY
+void cache_put (int cache_id, bool dirty);
+
+// write all dirty cache back to disk, keeping it cached. Also used as
+// the explicit sync
 void cache_back_to_disk ();
 
+// write back up to MAX of the oldest dirty caches in one batch sorted
+// by sector, only while due unless ALL. Returns how many were taken
+size_t cache_flush_batch (size_t max, bool all);
+
+// whether dirty caches are over the background ratio or too old
+bool cache_flush_due (void);
+
+// write back the pinned caches IDS of CNT consecutive sectors in one
+// disk command, setting WRITTEN[i] if IDS[i] was dirty
+void cache_flush_run (const int *ids, size_t cnt, bool *written);
+
+// qsort() order of cache indexes by sector number
+int cache_sector_less (const void *a, const void *b);
+
+// write back the pinned cache CACHE_ID for eviction, dropping
+// cache_big_lock meanwhile
+void cache_writeback (int cache_id);
+
+// queue the just dirtied cache CACHE_ID for write-behind
+void cache_dirty_enqueue (int cache_id);
+
+// take the cache CACHE_ID off the write-behind queue
+void cache_dirty_dequeue (int cache_id);
+
+// make a writer wait while dirty caches are over the high-water mark
+void cache_throttle (void);
+
+// find or load the cache of SECTOR_ID and hold it, EXCLUSIVE for
+// writing or shared for reading. Returns the cache index
+int cache_acquire (block_sector_t sector_id, bool exclusive, bool need_read);
+
+// release a cache held by cache_acquire(), marking it dirty if DIRTY
+void cache_release (int cache_id, bool exclusive, bool dirty);
+
+// wait until the pinned cache CACHE_ID is loaded and free, then hold it
+void cache_lock_slot (int cache_id, bool exclusive);
+
+// write the pinned cache CACHE_ID back to disk if it is dirty.
+// Returns whether it was written
+bool cache_flush_slot (int cache_id);
+
+// copy the cache counters into STATS
+void cache_get_stats (struct cache_stats *stats);
+
+// print the cache size, hit rate and the other cache counters
+void cache_print_stats (void);
+
+// acquire cache_big_lock, counting the time spent waiting for it
+void cache_lock_index (void);
+
+// add a page of buffers to the cache if it may grow. Returns whether
+// it grew
+bool cache_grow (void);
+
+// give a page of buffers back to palloc, e.g. when user processes are
+// short of memory. Returns whether a page was freed
+bool cache_shrink (void);
+
 // find the cache index corresponding to SECTOR_ID
 int find_sector (block_sector_t sector_id);
 
-// get free cache. Evict if necessary
+// the hash bucket that the cache holding SECTOR_ID lives in
+struct list *cache_bucket (block_sector_t sector_id);
+
+// index the used cache CACHE_ID by its sector
+void cache_hash_insert (int cache_id);
+
+// drop the used cache CACHE_ID from the sector index
+void cache_hash_remove (int cache_id);
+
+// get free cache. Evict if necessary. Returns -1 if cache_big_lock
+// had to be dropped, in which case the caller must look up again
 int fetch_free_cache ();
 
-// increase accessed number of all cache except the cache being operating.
-// Used for LRU.
-void increase_accessed (int cache_operating);
+// run the clock to find an unpinned cache to evict, -1 if none
+int cache_clock_victim (void);
+
+// pick an unpinned cache to evict under 2Q, only a clean one of the
+// A1in queue for PREFETCH. Returns -1 if none
+int cache_2q_victim (bool prefetch);
+
+// the unpinned cache nearest the back of a 2Q QUEUE, -1 if none
+int cache_queue_victim (struct list *queue, bool clean_only);
+
+// record an access to the used cache CACHE_ID for the policy
+void cache_touch (int cache_id);
+
+// queue the newly loaded cache CACHE_ID for replacement
+void cache_admit (int cache_id);
+
+// take the used cache CACHE_ID out of the index and policy queues
+void cache_drop (int cache_id);
+
+// remember an evicted sector in the 2Q A1out ghost queue
+void cache_ghost_remember (block_sector_t sector_id);
+
+// forget SECTOR_ID from the A1out ghost queue. Returns whether it
+// was remembered
+bool cache_ghost_forget (block_sector_t sector_id);
+
+// the hash bucket that the ghost of SECTOR_ID lives in
+struct list *cache_ghost_bucket (block_sector_t sector_id);
 
 // thread function for write-behind
-void write_behind_func ();
+void write_behind_func (void *aux);
 
-// periodically write back all the cache into disk
+// start the thread that writes dirty caches back when they get old
+// or too many
 void write_behind ();
 
 // thread function used for read_ahead
-void read_ahead_func ();
+void read_ahead_func (void *aux);
+
+/* start the thread that fetches blocks of a file into the cache ahead
+   of sequential readers, in case those blocks are about to be read */
+void read_ahead ();
+
+// queue SECTOR_ID to be loaded by the read_ahead thread
+void cache_read_ahead (block_sector_t sector_id);
+
+// load SECTOR_ID into a free or clean cache, if one is to be had
+void cache_prefetch (block_sector_t sector_id);
+// completion hook for a read queued by cache_prefetch
+void cache_prefetch_done (struct block_request *r);
+// mark prefetched cache CACHE_ID loaded and unpin it
+void cache_prefetch_finish (int cache_id);
 
-/* automatically fetch the next block of a file into the cache when 
-   one block of a file is read, in case that block is about to be read */
-void read_ahead ();
\ No newline at end of file
+// get a free or clean, unpinned, unaccessed cache without sleeping.
+// Returns -1 if there is none
+int fetch_clean_cache (void);
\ No newline at end of file
@@ -2,9 +2,13 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
@@ -13,6 +17,9 @@ struct dir
   {
     struct inode *inode;                /* Backing store. */
     off_t pos;                          /* Current position. */
+    /************************ NEW CODE ***************************/
+    bool indexed;                       /* Hash indexed, not linear? */
+    /********************** END NEW CODE *************************/
   };
 
 /* A single directory entry. */
@@ -23,29 +30,288 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/************************ NEW CODE ***************************/
+/* An indexed directory is a tree keyed on the hash of entry names,
+   like the htree of ext3.  Its first block is the root of the
+   index, with "." and ".." where a linear directory has them; the
+   other blocks are leaves of DIR_LEAF_ENTRIES entries, never split
+   across sectors, and the index nodes of the levels between.  An
+   index entry maps the hashes from its own up to the next entry's
+   to a block, so a lookup reads one block per level and scans one
+   leaf.  Entries with the same hash always share a leaf.  A
+   directory made before the index existed has no DIR_INDEX_MAGIC
+   after "." and "..", and is read and written linearly as ever. */
+#define DIR_INDEX_MAGIC 0x48545245
+// entries in a leaf block
+#define DIR_LEAF_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+// index entries in the root and in the other index nodes
+#define DIR_ROOT_ENTRIES 57
+#define DIR_NODE_ENTRIES 63
+// most index levels below the root
+#define DIR_DEPTH_MAX 2
+
+/* Maps names hashing to HASH and up to a block of the directory. */
+struct dir_index_entry
+  {
+    uint32_t hash;                      /* Lowest hash mapped. */
+    uint32_t block;                     /* Block in the directory. */
+  };
+
+/* Block 0 of an indexed directory. */
+struct dir_root
+  {
+    struct dir_entry dots[2];           /* "." and "..". */
+    uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+    uint32_t depth;                     /* Index levels below this. */
+    uint32_t block_cnt;                 /* Blocks in use. */
+    uint32_t count;                     /* Entries in INDEX. */
+    struct dir_index_entry index[DIR_ROOT_ENTRIES];
+  };
+
+/* An index block below the root. */
+struct dir_node
+  {
+    uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+    uint32_t count;                     /* Entries in INDEX. */
+    struct dir_index_entry index[DIR_NODE_ENTRIES];
+  };
+
+/* A leaf block. */
+struct dir_leaf
+  {
+    struct dir_entry entries[DIR_LEAF_ENTRIES];
+    uint8_t unused[BLOCK_SECTOR_SIZE
+                   - DIR_LEAF_ENTRIES * sizeof (struct dir_entry)];
+  };
+
+static bool index_lookup (const struct dir *, const char *name,
+                          struct dir_entry *, off_t *);
+static bool index_add (struct dir *, const char *name, block_sector_t);
+static bool next_entry (struct dir *, off_t *pos, struct dir_entry *);
+/********************** END NEW CODE *************************/
+
+/************************ NEW CODE ***************************/
+/* Dentry cache: the result of looking up a name in a directory,
+   kept so that resolving the same path again, or one sharing its
+   leading directories, does not read the directories again.  An
+   entry maps the sector of a directory and a name in it to the
+   sector of that entry's inode, or to DENTRY_NEGATIVE if there is
+   no such entry, which makes the lookup before each create as cheap
+   as a positive one.  Entries are looked up and changed under the
+   lock of their directory, and dir_add() and dir_remove() drop
+   those they make stale; the DENTRY_MAX used least recently are
+   kept. */
+#define DENTRY_MAX 256
+#define DENTRY_NEGATIVE ((block_sector_t) -1)
+
+struct dentry
+  {
+    struct hash_elem elem;              /* Element in dentries. */
+    struct list_elem lru_elem;          /* Element in dentry_lru. */
+    block_sector_t parent;              /* Sector of the directory. */
+    char name[NAME_MAX + 1];            /* Name in the directory. */
+    block_sector_t child;               /* Its inode, or DENTRY_NEGATIVE. */
+  };
+
+static struct hash dentries;
+// most recently used first
+static struct list dentry_lru;
+static size_t dentry_cnt;
+// guards the above and the counters below
+static struct lock dentry_lock;
+static unsigned long long dentry_hits;
+static unsigned long long dentry_negative_hits;
+static unsigned long long dentry_misses;
+
+/* Hash function for dentries. */
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, elem);
+  return hash_string (d->name) ^ hash_int (d->parent);
+}
+
+/* Orders dentries by directory, then name. */
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, elem);
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
+
+/* Returns the cached entry for NAME in the directory at PARENT, or
+   a null pointer.  The caller holds dentry_lock. */
+static struct dentry *
+dentry_find (block_sector_t parent, const char *name)
+{
+  struct dentry key;
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  struct hash_elem *e = hash_find (&dentries, &key.elem);
+  return e != NULL ? hash_entry (e, struct dentry, elem) : NULL;
+}
+
+/* Drops D.  The caller holds dentry_lock. */
+static void
+dentry_drop (struct dentry *d)
+{
+  hash_delete (&dentries, &d->elem);
+  list_remove (&d->lru_elem);
+  dentry_cnt--;
+  free (d);
+}
+
+/* Looks NAME up in the directory at PARENT.  Returns true on a hit,
+   setting *CHILD to the cached sector or DENTRY_NEGATIVE. */
+static bool
+dentry_lookup (block_sector_t parent, const char *name,
+               block_sector_t *child)
+{
+  lock_acquire (&dentry_lock);
+  struct dentry *d = dentry_find (parent, name);
+  if (d != NULL)
+    {
+      list_remove (&d->lru_elem);
+      list_push_front (&dentry_lru, &d->lru_elem);
+      *child = d->child;
+      dentry_hits++;
+      if (d->child == DENTRY_NEGATIVE)
+        dentry_negative_hits++;
+    }
+  else
+    dentry_misses++;
+  lock_release (&dentry_lock);
+  return d != NULL;
+}
+
+/* Caches that NAME in the directory at PARENT is CHILD, making room
+   by dropping the entry used least recently. */
+static void
+dentry_insert (block_sector_t parent, const char *name,
+               block_sector_t child)
+{
+  if (strlen (name) > NAME_MAX)
+    return;
+  struct dentry *d = malloc (sizeof *d);
+  if (d == NULL)
+    return;
+  d->parent = parent;
+  strlcpy (d->name, name, sizeof d->name);
+  d->child = child;
+
+  lock_acquire (&dentry_lock);
+  struct hash_elem *old = hash_replace (&dentries, &d->elem);
+  if (old != NULL)
+    {
+      struct dentry *o = hash_entry (old, struct dentry, elem);
+      list_remove (&o->lru_elem);
+      free (o);
+    }
+  else
+    dentry_cnt++;
+  list_push_front (&dentry_lru, &d->lru_elem);
+  if (dentry_cnt > DENTRY_MAX)
+    dentry_drop (list_entry (list_back (&dentry_lru),
+                             struct dentry, lru_elem));
+  lock_release (&dentry_lock);
+}
+
+/* Drops the entry for NAME in the directory at PARENT, if cached. */
+static void
+dentry_invalidate (block_sector_t parent, const char *name)
+{
+  lock_acquire (&dentry_lock);
+  struct dentry *d = dentry_find (parent, name);
+  if (d != NULL)
+    dentry_drop (d);
+  lock_release (&dentry_lock);
+}
+
+/* Drops every entry for names in the directory at PARENT, which is
+   being removed, so a directory later made in its sector does not
+   inherit them. */
+static void
+dentry_purge (block_sector_t parent)
+{
+  lock_acquire (&dentry_lock);
+  struct list_elem *e = list_begin (&dentry_lru);
+  while (e != list_end (&dentry_lru))
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      e = list_next (e);
+      if (d->parent == parent)
+        dentry_drop (d);
+    }
+  lock_release (&dentry_lock);
+}
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  if (!hash_init (&dentries, dentry_hash, dentry_less, NULL))
+    PANIC ("can't create dentry cache");
+  list_init (&dentry_lru);
+  dentry_cnt = 0;
+  lock_init (&dentry_lock);
+}
+
+/* Prints how often path lookups were answered by the dentry
+   cache. */
+void
+dir_print_stats (void)
+{
+  printf ("Dentry cache: %llu hits (%llu negative), %llu misses\n",
+          dentry_hits, dentry_negative_hits, dentry_misses);
+}
+/********************** END NEW CODE *************************/
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt UNUSED)
 {
   // return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
   /************************ NEW CODE ***************************/
-  bool success = inode_create (sector, (entry_cnt+2) 
-                  * sizeof (struct dir_entry));
+  // an indexed directory grows a leaf at a time, so ENTRY_CNT needs
+  // no room set aside: it starts as the root and one empty leaf
+  ASSERT (sizeof (struct dir_root) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_node) == BLOCK_SECTOR_SIZE);
+  ASSERT (sizeof (struct dir_leaf) == BLOCK_SECTOR_SIZE);
+
+  struct dir_root *root = calloc (1, sizeof *root);
+  if (root == NULL)
+    return false;
+  bool success = inode_create (sector, 2 * BLOCK_SECTOR_SIZE);
   if (success)
     {
       struct inode* inode = inode_open (sector);
       ASSERT (inode != NULL);
       inode_set_dir (inode);
 
-      struct dir* dir = dir_open (inode);
-      ASSERT (dir != NULL);
-      // add . to directory
-      ASSERT (dir_add(dir, ".", sector));
-      // add .. to directory
-      ASSERT (dir_add(dir, "..", sector));
-      dir_close(dir);
+      // . and .. both point here until dir_add() sets ..
+      for (int i = 0; i < 2; i++)
+        {
+          root->dots[i].inode_sector = sector;
+          strlcpy (root->dots[i].name, i == 0 ? "." : "..",
+                   sizeof root->dots[i].name);
+          root->dots[i].in_use = true;
+        }
+      root->magic = DIR_INDEX_MAGIC;
+      root->depth = 0;
+      root->block_cnt = 2;
+      root->count = 1;
+      root->index[0].hash = 0;
+      root->index[0].block = 1;
+      success = inode_write_at (inode, root, sizeof *root, 0)
+                == sizeof *root;
+      inode_close (inode);
     }
+  free (root);
   return success;
   /********************** END NEW CODE *************************/
 }
@@ -61,6 +327,12 @@ dir_open (struct inode *inode)
       /************************ NEW CODE ***************************/
       dir->inode = inode;
       dir->pos = 2 * sizeof(struct dir_entry);
+      // an indexed directory has its magic right after . and ..
+      uint32_t magic;
+      dir->indexed = inode_read_at (inode, &magic, sizeof magic,
+                                    offsetof (struct dir_root, magic))
+                     == sizeof magic
+                     && magic == DIR_INDEX_MAGIC;
       /********************** END NEW CODE *************************/
       return dir;
     }
@@ -117,21 +389,63 @@ lookup (const struct dir *dir, const char *name,
 {
   struct dir_entry e;
   size_t ofs;
+  /************************ NEW CODE ***************************/
+  size_t length = inode_length (dir->inode);
+  block_sector_t sector = -1;
+  int cache_id = -1;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
+  if (dir->indexed)
+    return index_lookup (dir, name, ep, ofsp);
+
+  // compare entries in place in the pinned cache of each directory
+  // sector; only an entry straddling two sectors is copied out
+  for (ofs = 0; ofs + sizeof e <= length; ofs += sizeof e) 
+    {
+      const struct dir_entry *entry;
+      size_t sector_ofs = ofs % BLOCK_SECTOR_SIZE;
+
+      if (sector_ofs + sizeof e <= BLOCK_SECTOR_SIZE)
+        {
+          block_sector_t entry_sector = inode_sector_at (dir->inode, ofs);
+          if (entry_sector != sector)
+            {
+              if (cache_id != -1)
+                cache_put (cache_id, false);
+              sector = entry_sector;
+              cache_id = cache_get (sector, false);
+            }
+          entry = (const struct dir_entry *)
+                  ((uint8_t *) cache_data (cache_id) + sector_ofs);
+        }
+      else
+        {
+          if (cache_id != -1)
+            cache_put (cache_id, false);
+          cache_id = -1;
+          sector = -1;
+          if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+            break;
+          entry = &e;
+        }
+
+      if (entry->in_use && !strcmp (name, entry->name)) 
+        {
+          if (ep != NULL)
+            *ep = *entry;
+          if (ofsp != NULL)
+            *ofsp = ofs;
+          if (cache_id != -1)
+            cache_put (cache_id, false);
+          return true;
+        }
+    }
+  if (cache_id != -1)
+    cache_put (cache_id, false);
   return false;
+  /********************** END NEW CODE *************************/
 }
 
 /* Searches DIR for a file with the given NAME
@@ -147,10 +461,28 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  // if (lookup (dir, name, &e, NULL))
+  //   *inode = inode_open (e.inode_sector);
+  // else
+  //   *inode = NULL;
+  /************************ NEW CODE ***************************/
+  inode_lock_dir (dir->inode);
+  block_sector_t parent = inode_get_inumber (dir->inode);
+  block_sector_t child;
+  if (dentry_lookup (parent, name, &child))
+    *inode = child != DENTRY_NEGATIVE ? inode_open (child) : NULL;
+  else if (lookup (dir, name, &e, NULL))
+    {
+      *inode = inode_open (e.inode_sector);
+      dentry_insert (parent, name, e.inode_sector);
+    }
   else
-    *inode = NULL;
+    {
+      *inode = NULL;
+      dentry_insert (parent, name, DENTRY_NEGATIVE);
+    }
+  inode_unlock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
 
   return *inode != NULL;
 }
@@ -175,10 +507,33 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  /************************ NEW CODE ***************************/
+  // checking for NAME and taking a slot are one step, and nothing
+  // goes into a directory that rmdir has just taken away
+  inode_lock_dir (dir->inode);
+  if (inode_is_removed (dir->inode))
+    goto done;
+  /********************** END NEW CODE *************************/
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  // if (lookup (dir, name, NULL, NULL))
+  //   goto done;
+
+  /************************ NEW CODE ***************************/
+  // a cached answer saves the scan
+  block_sector_t parent = inode_get_inumber (dir->inode);
+  block_sector_t child;
+  if (dentry_lookup (parent, name, &child) ? child != DENTRY_NEGATIVE
+                                           : lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (dir->indexed)
+    {
+      success = index_add (dir, name, inode_sector);
+      goto added;
+    }
+  /********************** END NEW CODE *************************/
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -197,7 +552,13 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
+ added:
   /************************ NEW CODE ***************************/
+  // the name's cached answer, "not found" most likely, is stale now
+  if (success)
+    dentry_insert (parent, name, inode_sector);
+  else
+    dentry_invalidate (parent, name);
   if (name[0] == '.')
     goto done;
   if (success)
@@ -217,6 +578,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
           ep.inode_sector = inode_get_inumber (dir->inode);
           ASSERT (inode_write_at (d->inode, &ep, sizeof (ep), ofsp)
                    == sizeof (ep));
+          dentry_invalidate (inode_sector, "..");
           dir_close (d);
         }
       else
@@ -226,6 +588,9 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     }
   /********************** END NEW CODE *************************/
  done:
+  /************************ NEW CODE ***************************/
+  inode_unlock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
   return success;
 }
 
@@ -243,6 +608,9 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /************************ NEW CODE ***************************/
+  inode_lock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -260,8 +628,16 @@ dir_remove (struct dir *dir, const char *name)
   /* Remove inode. */
   inode_remove (inode);
   success = true;
+  /************************ NEW CODE ***************************/
+  dentry_insert (inode_get_inumber (dir->inode), name, DENTRY_NEGATIVE);
+  if (inode_is_dir (inode))
+    dentry_purge (e.inode_sector);
+  /********************** END NEW CODE *************************/
 
  done:
+  /************************ NEW CODE ***************************/
+  inode_unlock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
   inode_close (inode);
   return success;
 }
@@ -274,89 +650,136 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /************************ NEW CODE ***************************/
+  inode_lock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
+  // while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  //   {
+  //     dir->pos += sizeof e;
+  /************************ NEW CODE ***************************/
+  while (next_entry (dir, &dir->pos, &e))
     {
-      dir->pos += sizeof e;
+  /********************** END NEW CODE *************************/
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
+          /************************ NEW CODE ***************************/
+          inode_unlock_dir (dir->inode);
+          /********************** END NEW CODE *************************/
           return true;
         } 
     }
+  /************************ NEW CODE ***************************/
+  inode_unlock_dir (dir->inode);
+  /********************** END NEW CODE *************************/
   return false;
 }
 
 /************************ NEW CODE ***************************/
-// divide the path into directory and file name
+// divide the path into directory and file name, in one pass over
+// NAME: each directory on the way is looked up, through the dentry
+// cache, and opened in turn, and the last component is the name
 bool 
 dir_divide (char *name, struct dir *cur_dir, struct dir **ret_dir,
             char **ret_name)
 {
   ASSERT (cur_dir != NULL);
-  if (*name == NULL){
+  if (*name == '\0'){
     return false;
   }
   
-  char *path = malloc(strlen (name) + 1);
-  strlcpy (path, name, PGSIZE);
-  char *token, *save_ptr;
-  struct inode *inode = NULL;
   if (name[0] == '/')
     {
       // under root directory
       dir_close (cur_dir);
       cur_dir = dir_open_root ();
     }
-  // count for directories
-  int count = 0;
-  // divide the path by '/'
-  for (token = strtok_r (path, "/", &save_ptr); token != NULL;
-      token = strtok_r (NULL, "/", &save_ptr))
+  const char *p = name;
+  const char *last = NULL;
+  size_t last_len = 0;
+  for (;;)
     {
-      count++;
-    }
-  int i = 0;
-  strlcpy (path, name, PGSIZE);
-  for (token = strtok_r (path, "/", &save_ptr); token != NULL;
-      token = strtok_r (NULL, "/", &save_ptr))
-    {
-      if (i==count-1)
+      while (*p == '/')
+        p++;
+      if (*p == '\0')
         break;
-      // search every token in the current directory
-      if (!dir_lookup (cur_dir, token, &inode))
+      const char *end = p;
+      while (*end != '\0' && *end != '/')
+        end++;
+      const char *next = end;
+      while (*next == '/')
+        next++;
+      if (*next == '\0')
+        {
+          // the last component names the file, not a directory
+          last = p;
+          last_len = end - p;
+          break;
+        }
+
+      // search every other component in the current directory
+      char part[NAME_MAX + 1];
+      struct inode *inode = NULL;
+      if ((size_t) (end - p) > NAME_MAX)
+        {
+          dir_close (cur_dir);
+          return false;
+        }
+      memcpy (part, p, end - p);
+      part[end - p] = '\0';
+      if (!dir_lookup (cur_dir, part, &inode) || !inode_is_dir (inode))
         {
+          inode_close (inode);
           dir_close (cur_dir);
-          free (path);
           return false;
         }
       dir_close (cur_dir);
       cur_dir = dir_open (inode);
-      i++;
+      if (cur_dir == NULL)
+        return false;
+      p = next;
     }
-  *ret_dir = dir_reopen(cur_dir);
-  if (token == NULL)
+  *ret_dir = cur_dir;
+  if (last == NULL)
     {
       (*ret_name)[0] = '.';
       (*ret_name)[1] = '\0';
     }
   else
-    strlcpy(*ret_name, token, 15);
-  dir_close (cur_dir);
-  free (path);
+    {
+      if (last_len > NAME_MAX)
+        last_len = NAME_MAX;
+      memcpy (*ret_name, last, last_len);
+      (*ret_name)[last_len] = '\0';
+    }
   return true;
 }
 
-// whether DIR is empty
+// lock DIR against changes to its entries, for a check that must
+// hold until a change is made, like rmdir's that DIR is empty
+void
+dir_lock (struct dir *dir)
+{
+  inode_lock_dir (dir->inode);
+}
+
+// unlock DIR
+void
+dir_unlock (struct dir *dir)
+{
+  inode_unlock_dir (dir->inode);
+}
+
+// whether DIR is empty; the caller holds dir_lock (DIR)
 bool 
 dir_empty (struct dir *dir)
 {
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
   
   ASSERT (dir != NULL);
   int count = 0;
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
+  for (ofs = 0; next_entry (dir, &ofs, &e); ) 
     if (e.in_use) 
       {
         count++;
@@ -364,17 +787,16 @@ dir_empty (struct dir *dir)
   return count == 2;
 }
 
-// clear DIR
+// clear DIR; the caller holds dir_lock (DIR)
 bool 
 dir_clear (struct dir *dir)
 {
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs;
   
   ASSERT (dir != NULL);
   int count = 0;
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
+  for (ofs = 0; next_entry (dir, &ofs, &e); ) 
     {
       if (e.in_use)
         {
@@ -385,4 +807,359 @@ dir_clear (struct dir *dir)
   ASSERT (count==2);
   return true;
 }
-/********************** END NEW CODE *************************/
\ No newline at end of file
+/* Reads the next entry of DIR at or after *POS into *E and moves
+   *POS past it.  Returns false at the end of the directory.  In an
+   indexed directory the index blocks are skipped, and the root has
+   no entries but . and .. */
+static bool
+next_entry (struct dir *dir, off_t *pos, struct dir_entry *e)
+{
+  for (;;)
+    {
+      if (dir->indexed)
+        {
+          if (*pos >= (off_t) (2 * sizeof *e) && *pos < BLOCK_SECTOR_SIZE)
+            *pos = BLOCK_SECTOR_SIZE;
+          else if (*pos % BLOCK_SECTOR_SIZE
+                   >= (off_t) (DIR_LEAF_ENTRIES * sizeof *e))
+            *pos = ROUND_UP (*pos, BLOCK_SECTOR_SIZE);
+        }
+      if (inode_read_at (dir->inode, e, sizeof *e, *pos) != sizeof *e)
+        return false;
+      // an index block starts with the magic, where a leaf starts
+      // with an inode sector
+      if (dir->indexed && *pos >= BLOCK_SECTOR_SIZE
+          && *pos % BLOCK_SECTOR_SIZE == 0
+          && e->inode_sector == DIR_INDEX_MAGIC)
+        {
+          *pos += BLOCK_SECTOR_SIZE;
+          continue;
+        }
+      *pos += sizeof *e;
+      return true;
+    }
+}
+
+/* Returns the position in INDEX, of COUNT entries, of the one
+   mapping HASH: the last whose hash is not above it. */
+static uint32_t
+index_find (const struct dir_index_entry *index, uint32_t count,
+            uint32_t hash)
+{
+  uint32_t lo = 0, hi = count;
+  while (lo < hi)
+    {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (index[mid].hash <= hash)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo > 0 ? lo - 1 : 0;
+}
+
+/* Pins block BLOCK of DIR in the cache for reading and points
+   *DATA at it.  Returns the cache id, -1 if DIR has no such
+   block. */
+static int
+index_block_get (const struct dir *dir, uint32_t block, const void **data)
+{
+  block_sector_t sector = inode_sector_at (dir->inode,
+                                           block * BLOCK_SECTOR_SIZE);
+  if (sector == (block_sector_t) -1)
+    return -1;
+  int cache_id = cache_get (sector, false);
+  *data = cache_data (cache_id);
+  return cache_id;
+}
+
+/* lookup() for an indexed DIR: walks the index down to the one
+   leaf that may hold NAME, in the pinned cache of each block. */
+static bool
+index_lookup (const struct dir *dir, const char *name,
+              struct dir_entry *ep, off_t *ofsp)
+{
+  const struct dir_root *root;
+  int cache_id = index_block_get (dir, 0, (const void **) &root);
+  if (cache_id == -1)
+    return false;
+
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    {
+      int i = name[1] == '.';
+      bool found = root->dots[i].in_use;
+      if (found && ep != NULL)
+        *ep = root->dots[i];
+      if (found && ofsp != NULL)
+        *ofsp = i * sizeof (struct dir_entry);
+      cache_put (cache_id, false);
+      return found;
+    }
+
+  uint32_t hash = hash_string (name);
+  uint32_t depth = root->depth;
+  uint32_t block = root->index[index_find (root->index, root->count,
+                                           hash)].block;
+  cache_put (cache_id, false);
+  for (uint32_t level = 0; level < depth; level++)
+    {
+      const struct dir_node *node;
+      cache_id = index_block_get (dir, block, (const void **) &node);
+      if (cache_id == -1)
+        return false;
+      block = node->index[index_find (node->index, node->count,
+                                      hash)].block;
+      cache_put (cache_id, false);
+    }
+
+  const struct dir_leaf *leaf;
+  cache_id = index_block_get (dir, block, (const void **) &leaf);
+  if (cache_id == -1)
+    return false;
+  bool found = false;
+  for (size_t i = 0; i < DIR_LEAF_ENTRIES; i++)
+    {
+      const struct dir_entry *entry = &leaf->entries[i];
+      if (entry->in_use && !strcmp (name, entry->name))
+        {
+          if (ep != NULL)
+            *ep = *entry;
+          if (ofsp != NULL)
+            *ofsp = block * BLOCK_SECTOR_SIZE + i * sizeof *entry;
+          found = true;
+          break;
+        }
+    }
+  cache_put (cache_id, false);
+  return found;
+}
+
+/* Scratch space for index_add(), too big for the kernel stack. */
+struct index_scratch
+  {
+    struct dir_root root;
+    struct dir_leaf leaf;
+    struct dir_node node;
+    // the index nodes on the path to the leaf, as they are to be
+    // written back, by level
+    struct dir_node path[DIR_DEPTH_MAX + 1];
+    // a full leaf and the new entry, and their hashes
+    struct dir_entry entries[DIR_LEAF_ENTRIES + 1];
+    uint32_t hashes[DIR_LEAF_ENTRIES + 1];
+    // a full index node and the new index entry
+    struct dir_index_entry index[DIR_NODE_ENTRIES + 1];
+  };
+
+/* Reads block BLOCK of DIR into BUF. */
+static bool
+index_block_read (struct dir *dir, uint32_t block, void *buf)
+{
+  return inode_read_at (dir->inode, buf, BLOCK_SECTOR_SIZE,
+                        block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
+/* Writes BUF to block BLOCK of DIR, growing it if need be. */
+static bool
+index_block_write (struct dir *dir, uint32_t block, const void *buf)
+{
+  return inode_write_at (dir->inode, buf, BLOCK_SECTOR_SIZE,
+                         block * BLOCK_SECTOR_SIZE) == BLOCK_SECTOR_SIZE;
+}
+
+/* Inserts E at position POS of INDEX, which has COUNT entries and
+   room for one more. */
+static void
+index_insert (struct dir_index_entry *index, uint32_t count, uint32_t pos,
+              struct dir_index_entry e)
+{
+  memmove (index + pos + 1, index + pos, (count - pos) * sizeof *index);
+  index[pos] = e;
+}
+
+/* dir_add() for an indexed DIR, which does not hold NAME.  Puts the
+   entry in a free slot of the leaf for its hash.  A full leaf is
+   split in two at a hash boundary near its middle, and the new
+   leaf goes into the index node above, splitting full index nodes
+   on the way up; a full root moves its index down a level, up to
+   DIR_DEPTH_MAX levels.  The directory is first grown to hold every
+   new block, and the new blocks are written before any block in use
+   is overwritten, the root last, so a failure never loses entries.
+   Fails without changing DIR if the index is full, or if every name
+   in the leaf has the same hash. */
+static bool
+index_add (struct dir *dir, const char *name, block_sector_t inode_sector)
+{
+  struct index_scratch *s = malloc (sizeof *s);
+  if (s == NULL)
+    return false;
+  bool success = false;
+  if (!index_block_read (dir, 0, &s->root))
+    goto done;
+
+  // walk down to the leaf, remembering each index block, its entry
+  // count and the position taken in it
+  uint32_t hash = hash_string (name);
+  uint32_t depth = s->root.depth;
+  uint32_t path_block[DIR_DEPTH_MAX + 1];
+  uint32_t path_pos[DIR_DEPTH_MAX + 1];
+  uint32_t path_count[DIR_DEPTH_MAX + 1];
+  path_block[0] = 0;
+  path_count[0] = s->root.count;
+  path_pos[0] = index_find (s->root.index, s->root.count, hash);
+  uint32_t block = s->root.index[path_pos[0]].block;
+  for (uint32_t level = 1; level <= depth; level++)
+    {
+      if (!index_block_read (dir, block, &s->node))
+        goto done;
+      path_block[level] = block;
+      path_count[level] = s->node.count;
+      path_pos[level] = index_find (s->node.index, s->node.count, hash);
+      block = s->node.index[path_pos[level]].block;
+    }
+  if (!index_block_read (dir, block, &s->leaf))
+    goto done;
+
+  struct dir_entry e;
+  e.inode_sector = inode_sector;
+  strlcpy (e.name, name, sizeof e.name);
+  e.in_use = true;
+  for (size_t i = 0; i < DIR_LEAF_ENTRIES; i++)
+    if (!s->leaf.entries[i].in_use)
+      {
+        off_t ofs = block * BLOCK_SECTOR_SIZE + i * sizeof e;
+        success = inode_write_at (dir->inode, &e, sizeof e, ofs)
+                  == sizeof e;
+        goto done;
+      }
+
+  // the leaf is full: make sure the index can take one more leaf
+  // before changing anything
+  int full = depth;
+  while (full > 0 && path_count[full] == DIR_NODE_ENTRIES)
+    full--;
+  if (full == 0 && path_count[0] == DIR_ROOT_ENTRIES
+      && depth == DIR_DEPTH_MAX)
+    goto done;
+
+  // sort the leaf and the new entry by hash, and split them where
+  // the hash changes nearest the middle
+  size_t n = 0;
+  for (size_t i = 0; i <= DIR_LEAF_ENTRIES; i++)
+    {
+      const struct dir_entry *add = i < DIR_LEAF_ENTRIES ?
+                                    &s->leaf.entries[i] : &e;
+      uint32_t h = i < DIR_LEAF_ENTRIES ? hash_string (add->name) : hash;
+      size_t j = n++;
+      for (; j > 0 && s->hashes[j - 1] > h; j--)
+        {
+          s->entries[j] = s->entries[j - 1];
+          s->hashes[j] = s->hashes[j - 1];
+        }
+      s->entries[j] = *add;
+      s->hashes[j] = h;
+    }
+  size_t split = 0;
+  for (size_t d = 0; d <= n / 2 && split == 0; d++)
+    {
+      if (n / 2 + d < n && s->hashes[n / 2 + d - 1] != s->hashes[n / 2 + d])
+        split = n / 2 + d;
+      else if (n / 2 - d > 0
+               && s->hashes[n / 2 - d - 1] != s->hashes[n / 2 - d])
+        split = n / 2 - d;
+    }
+  if (split == 0)
+    goto done;
+
+  // grow DIR to hold the blocks the split takes, up front: the new
+  // leaf, a node for each full index node on the path, and another if
+  // the root is full too
+  uint32_t new_cnt = 1 + (depth - full);
+  if (full == 0 && path_count[0] == DIR_ROOT_ENTRIES)
+    new_cnt++;
+  memset (&s->leaf, 0, sizeof s->leaf);
+  if (!index_block_write (dir, s->root.block_cnt + new_cnt - 1, &s->leaf))
+    goto done;
+
+  uint32_t new_block = s->root.block_cnt++;
+  memcpy (s->leaf.entries, s->entries + split, (n - split) * sizeof e);
+  if (!index_block_write (dir, new_block, &s->leaf))
+    goto done;
+
+  // hook the new block into the index, from the bottom up.  New nodes
+  // are written as they are made; the changed nodes on the path are
+  // kept in S->path until every new block is in
+  struct dir_index_entry ie;
+  ie.hash = s->hashes[split];
+  ie.block = new_block;
+  int changed = depth + 1;
+  for (int level = depth; ; level--)
+    {
+      uint32_t pos = path_pos[level] + 1;
+      if (level == 0)
+        {
+          if (s->root.count == DIR_ROOT_ENTRIES)
+            {
+              // move the root's index down into a new node, which
+              // has room for it and IE
+              s->node.magic = DIR_INDEX_MAGIC;
+              s->node.count = s->root.count;
+              memcpy (s->node.index, s->root.index,
+                      s->root.count * sizeof ie);
+              index_insert (s->node.index, s->node.count++, pos, ie);
+              uint32_t node_block = s->root.block_cnt++;
+              if (!index_block_write (dir, node_block, &s->node))
+                goto done;
+              s->root.depth++;
+              s->root.count = 1;
+              s->root.index[0].hash = 0;
+              s->root.index[0].block = node_block;
+            }
+          else
+            index_insert (s->root.index, s->root.count++, pos, ie);
+          break;
+        }
+
+      struct dir_node *node = &s->path[level];
+      if (!index_block_read (dir, path_block[level], node))
+        goto done;
+      changed = level;
+      if (node->count < DIR_NODE_ENTRIES)
+        {
+          index_insert (node->index, node->count++, pos, ie);
+          break;
+        }
+
+      // split the full node in halves, and go on to hook the upper
+      // half into the level above
+      memcpy (s->index, node->index, node->count * sizeof ie);
+      index_insert (s->index, node->count, pos, ie);
+      uint32_t total = node->count + 1;
+      uint32_t half = total / 2;
+      node->count = half;
+      memcpy (node->index, s->index, half * sizeof ie);
+      uint32_t node_block = s->root.block_cnt++;
+      s->node.magic = DIR_INDEX_MAGIC;
+      s->node.count = total - half;
+      memcpy (s->node.index, s->index + half, s->node.count * sizeof ie);
+      if (!index_block_write (dir, node_block, &s->node))
+        goto done;
+      ie.hash = s->index[half].hash;
+      ie.block = node_block;
+    }
+
+  // every new block is in: now the old leaf, then the changed nodes
+  // from the bottom up, then the root
+  memset (&s->leaf, 0, sizeof s->leaf);
+  memcpy (s->leaf.entries, s->entries, split * sizeof e);
+  if (!index_block_write (dir, block, &s->leaf))
+    goto done;
+  for (int level = depth; level >= changed; level--)
+    if (!index_block_write (dir, path_block[level], &s->path[level]))
+      goto done;
+  success = index_block_write (dir, 0, &s->root);
+
+ done:
+  free (s);
+  return success;
+}
+/********************** END NEW CODE *************************/
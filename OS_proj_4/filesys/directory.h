@@ -28,10 +28,20 @@ bool dir_remove (struct dir *, const char *name);
 bool dir_readdir (struct dir *, char name[NAME_MAX + 1]);
 
 /************************ NEW CODE ***************************/
+/* initialize the dentry cache */
+void dir_init (void);
+
+/* print how often the dentry cache answered path lookups */
+void dir_print_stats (void);
+
 /* divide the path into directory and file name */
 bool dir_divide (char *name, struct dir *cur_dir, struct dir **ret_dir,
                  char **ret_name);
 
+/* lock and unlock DIR against changes to its entries */
+void dir_lock (struct dir *dir);
+void dir_unlock (struct dir *dir);
+
 /* whether DIR is empty */
 bool dir_empty (struct dir *dir);
 
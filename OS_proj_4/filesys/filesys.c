@@ -13,6 +13,9 @@
 struct block *fs_device;
 
 static void do_format (void);
+/************************ NEW CODE ***************************/
+static void discard_inode (block_sector_t sector);
+/********************** END NEW CODE *************************/
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -27,10 +30,18 @@ filesys_init (bool format)
     PANIC ("No file system device found, can't initialize file system.");
 
   inode_init ();
+  /************************ NEW CODE ***************************/
+  dir_init ();
+  /********************** END NEW CODE *************************/
   free_map_init ();
 
   if (format) 
     do_format ();
+  /************************ NEW CODE ***************************/
+  else
+    // keep growing files in the layout the disk was formatted with
+    inode_adopt_format (FREE_MAP_SECTOR);
+  /********************** END NEW CODE *************************/
 
   free_map_open ();
 }
@@ -42,6 +53,10 @@ filesys_done (void)
 {
   /************************ NEW CODE ***************************/
   cache_back_to_disk();
+  cache_print_stats ();
+  inode_print_stats ();
+  free_map_print_stats ();
+  dir_print_stats ();
   /********************** END NEW CODE *************************/
   free_map_close ();
 }
@@ -78,10 +93,22 @@ filesys_create (const char *name, off_t initial_size)
       free (ret_name);
       return NULL;
     }
+  // the new file's inode goes in its directory's block group
   success = (ret_dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (ret_dir, ret_name, inode_sector));
+                  && free_map_allocate (1, inode_get_inumber (
+                                          dir_get_inode (ret_dir)),
+                                        &inode_sector));
+  if (success && !inode_create (inode_sector, initial_size))
+    {
+      free_map_release (inode_sector, 1);
+      success = false;
+    }
+  else if (success && !dir_add (ret_dir, ret_name, inode_sector))
+    {
+      // another thread took the name since the lookup above
+      discard_inode (inode_sector);
+      success = false;
+    }
   dir_close (ret_dir);
   free (ret_name);
   /********************** END NEW CODE *************************/
@@ -161,10 +188,13 @@ filesys_remove (const char *name)
   else
     {
       struct dir* dir_to_remove = dir_open (inode);
+      // nothing may be added to it between the check and the removal
+      dir_lock (dir_to_remove);
       success = success && dir_empty (dir_to_remove) 
                         && (inode_open_count (inode) <= 1)
                         && dir_clear (dir_to_remove)
                         && dir_remove (ret_dir, ret_name);
+      dir_unlock (dir_to_remove);
     }
   inode_close (inode);
   dir_close (ret_dir);
@@ -186,6 +216,19 @@ do_format (void)
 }
 
 /************************ NEW CODE ***************************/
+/* Frees the inode at SECTOR and its data, for a file made but
+   never added to a directory. */
+static void
+discard_inode (block_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+  if (inode != NULL)
+    {
+      inode_remove (inode);
+      inode_close (inode);
+    }
+}
+
 /* Changes the current working directory of the process to dir,
    which may be relative or absolute. Returns true if successful, 
    false on failure. */
@@ -263,7 +306,8 @@ filesys_mkdir (const char *name)
     }
 
   block_sector_t sector;
-  if (!free_map_allocate (1, &sector) ||
+  // spread directories across the block groups
+  if (!free_map_allocate (1, free_map_dir_goal (), &sector) ||
       !dir_create (sector, 0))
     {
       dir_close (ret_dir);
@@ -272,6 +316,8 @@ filesys_mkdir (const char *name)
     }
   
   success = dir_add (ret_dir, ret_name, sector);
+  if (!success)
+    discard_inode (sector);
   dir_close (ret_dir);
   free (ret_name);
   return success;
@@ -4,9 +4,262 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+/************************ NEW CODE ***************************/
+#include <round.h>
+#include <stdio.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+/********************** END NEW CODE *************************/
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+/************************ NEW CODE ***************************/
+// sectors of the free map file whose bits changed since they were
+// written, one bit per sector
+static struct bitmap *free_map_dirty;
+// guards free_map and free_map_dirty
+static struct lock free_map_lock;
+// held while writing the free map, so flushes don't overtake each
+// other with older copies of the same sector
+static struct lock free_map_flush_lock;
+
+// bits of the free map in one sector of the free map file
+#define FREE_MAP_SECTOR_BITS (BLOCK_SECTOR_SIZE * 8)
+
+/* Free-extent index over the free map: a segment tree whose leaves
+   each summarize FREE_LEAF_BITS sectors, and whose inner nodes
+   combine their children, so a run of free sectors of any length
+   can be found near a hint by walking down from the root instead
+   of testing the bitmap bit by bit from sector 0.  Node 1 is the
+   root and nodes free_leaf_cnt through 2 * free_leaf_cnt - 1 are
+   the leaves; leaves past the end of the disk read as all used.
+   Guarded by free_map_lock, like the bitmap it indexes. */
+struct free_run
+  {
+    uint32_t prefix;            /* Free sectors at the start of the range. */
+    uint32_t suffix;            /* Free sectors at the end of the range. */
+    uint32_t max;               /* Longest run of free sectors in it. */
+  };
+
+// sectors summarized by a leaf of the index
+#define FREE_LEAF_BITS 32
+
+static struct free_run *free_tree;
+// leaves of free_tree, a power of two
+static size_t free_leaf_cnt;
+// free sectors in all, kept up to date for free_map_free_cnt()
+static size_t free_cnt;
+
+/* Block groups, as in FFS: the disk is cut into groups of
+   FREE_MAP_GROUP_SECTORS sectors, directories are spread across
+   them, and a file's inode and data are kept in the group of its
+   directory, so that working on one directory keeps the disk head
+   in one place.  The groups are only a placement policy: nothing
+   about them is stored on disk. */
+#define FREE_MAP_GROUP_SECTORS 1024
+
+// free sectors in each group. Guarded by free_map_lock
+static size_t *group_free;
+static size_t group_cnt;
+
+/* Adds DELTA, +1 or -1, times the number of sectors of the range of
+   CNT sectors from SECTOR that lie in it to the free count of each
+   group the range crosses. */
+static void
+group_count (block_sector_t sector, size_t cnt, int delta)
+{
+  while (cnt > 0)
+    {
+      size_t group = sector / FREE_MAP_GROUP_SECTORS;
+      size_t end = (group + 1) * FREE_MAP_GROUP_SECTORS;
+      size_t n = end - sector < cnt ? end - sector : cnt;
+      group_free[group] += delta * (int) n;
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Recomputes leaf LEAF of the index from the bitmap. */
+static void
+free_tree_leaf (size_t leaf)
+{
+  struct free_run *r = &free_tree[free_leaf_cnt + leaf];
+  size_t first = leaf * FREE_LEAF_BITS;
+  size_t sectors = bitmap_size (free_map);
+  bool at_start = true;
+  uint32_t run = 0;
+
+  r->prefix = r->max = 0;
+  for (size_t i = 0; i < FREE_LEAF_BITS; i++)
+    {
+      if (first + i < sectors && !bitmap_test (free_map, first + i))
+        {
+          if (++run > r->max)
+            r->max = run;
+        }
+      else
+        {
+          if (at_start)
+            r->prefix = run;
+          at_start = false;
+          run = 0;
+        }
+    }
+  if (at_start)
+    r->prefix = run;
+  r->suffix = run;
+}
+
+/* Recomputes inner node NODE of the index from its children, each
+   covering LEN sectors. */
+static void
+free_tree_pull (size_t node, uint32_t len)
+{
+  struct free_run *n = &free_tree[node];
+  const struct free_run *l = &free_tree[2 * node];
+  const struct free_run *r = &free_tree[2 * node + 1];
+
+  n->prefix = l->prefix == len ? len + r->prefix : l->prefix;
+  n->suffix = r->suffix == len ? len + l->suffix : r->suffix;
+  n->max = l->max > r->max ? l->max : r->max;
+  if (l->suffix + r->prefix > n->max)
+    n->max = l->suffix + r->prefix;
+}
+
+/* Brings the index up to date after the bits of CNT sectors from
+   SECTOR changed: the leaves holding them, then their ancestors a
+   level at a time. */
+static void
+free_tree_update (block_sector_t sector, size_t cnt)
+{
+  size_t lo = sector / FREE_LEAF_BITS;
+  size_t hi = (sector + cnt - 1) / FREE_LEAF_BITS;
+  for (size_t leaf = lo; leaf <= hi; leaf++)
+    free_tree_leaf (leaf);
+
+  lo += free_leaf_cnt;
+  hi += free_leaf_cnt;
+  for (uint32_t len = FREE_LEAF_BITS; lo > 1; len *= 2)
+    {
+      lo /= 2;
+      hi /= 2;
+      for (size_t node = lo; node <= hi; node++)
+        free_tree_pull (node, len);
+    }
+}
+
+/* Builds the index, and the free sector count, from the bitmap. */
+static void
+free_tree_build (void)
+{
+  size_t leaves = DIV_ROUND_UP (bitmap_size (free_map), FREE_LEAF_BITS);
+  if (free_tree == NULL)
+    {
+      for (free_leaf_cnt = 1; free_leaf_cnt < leaves; free_leaf_cnt *= 2)
+        continue;
+      free_tree = malloc (2 * free_leaf_cnt * sizeof *free_tree);
+      if (free_tree == NULL)
+        PANIC ("free map index creation failed--file system device is "
+               "too large");
+    }
+  free_tree_update (0, free_leaf_cnt * FREE_LEAF_BITS);
+  free_cnt = bitmap_count (free_map, 0, bitmap_size (free_map), false);
+
+  size_t sectors = bitmap_size (free_map);
+  if (group_free == NULL)
+    {
+      group_cnt = DIV_ROUND_UP (sectors, FREE_MAP_GROUP_SECTORS);
+      group_free = malloc (group_cnt * sizeof *group_free);
+      if (group_free == NULL)
+        PANIC ("free map index creation failed--file system device is "
+               "too large");
+    }
+  for (size_t i = 0; i < group_cnt; i++)
+    {
+      size_t first = i * FREE_MAP_GROUP_SECTORS;
+      size_t n = sectors - first < FREE_MAP_GROUP_SECTORS ?
+                 sectors - first : FREE_MAP_GROUP_SECTORS;
+      group_free[i] = bitmap_count (free_map, first, n, false);
+    }
+}
+
+/* Looks in index node NODE, covering the LEN sectors from LO, for
+   the first run of CNT free sectors starting at or after FROM.
+   *RUN holds the free sectors, from FROM on, just before LO, and
+   is updated to those just past the node.  A node that can't hold
+   the run is passed over as a whole, so only the nodes on the way
+   down to FROM and to the answer are visited.  Returns the first
+   sector of the run, or BITMAP_ERROR. */
+static size_t
+free_tree_find (size_t node, size_t lo, size_t len, size_t from,
+                size_t cnt, size_t *run)
+{
+  const struct free_run *n = &free_tree[node];
+  if (lo + len <= from)
+    return BITMAP_ERROR;
+  if (lo >= from)
+    {
+      if (*run + n->prefix >= cnt)
+        return lo - *run;
+      if (n->max < cnt)
+        {
+          *run = n->prefix == len ? *run + len : n->suffix;
+          return BITMAP_ERROR;
+        }
+    }
+
+  if (len == FREE_LEAF_BITS)
+    {
+      size_t sectors = bitmap_size (free_map);
+      for (size_t s = lo > from ? lo : from; s < lo + len; s++)
+        {
+          if (s < sectors && !bitmap_test (free_map, s))
+            {
+              if (++*run >= cnt)
+                return s + 1 - cnt;
+            }
+          else
+            *run = 0;
+        }
+      return BITMAP_ERROR;
+    }
+  size_t sector = free_tree_find (2 * node, lo, len / 2, from, cnt, run);
+  if (sector == BITMAP_ERROR)
+    sector = free_tree_find (2 * node + 1, lo + len / 2, len / 2, from,
+                             cnt, run);
+  return sector;
+}
+
+/* Returns the first sector of a run of CNT free sectors, the first
+   one at or after HINT if there is one and else the first on the
+   disk, or BITMAP_ERROR if there is no such run. */
+static size_t
+free_map_find (block_sector_t hint, size_t cnt)
+{
+  size_t run = 0;
+  if (cnt == 0 || free_tree[1].max < cnt)
+    return BITMAP_ERROR;
+  size_t sector = free_tree_find (1, 0, free_leaf_cnt * FREE_LEAF_BITS,
+                                  hint, cnt, &run);
+  if (sector == BITMAP_ERROR && hint > 0)
+    {
+      run = 0;
+      sector = free_tree_find (1, 0, free_leaf_cnt * FREE_LEAF_BITS, 0,
+                               cnt, &run);
+    }
+  return sector;
+}
+
+/* Marks the sectors of the free map file holding the bits of CNT
+   sectors from SECTOR as changed. */
+static void
+free_map_mark_dirty (block_sector_t sector, size_t cnt)
+{
+  size_t first = sector / FREE_MAP_SECTOR_BITS;
+  size_t last = (sector + cnt - 1) / FREE_MAP_SECTOR_BITS;
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+/********************** END NEW CODE *************************/
 
 /* Initializes the free map. */
 void
@@ -17,24 +270,45 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  /************************ NEW CODE ***************************/
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                BLOCK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
+  lock_init (&free_map_lock);
+  lock_init (&free_map_flush_lock);
+  free_tree_build ();
+  /********************** END NEW CODE *************************/
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  The first free run at or after GOAL is
+   taken, so passing the sector just after the last one a file got,
+   or one in the group it should live in, keeps it together; GOAL 0
+   is plain first fit.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.
+   The change reaches the free map file at the next
+   free_map_flush(). */
 bool
-free_map_allocate (size_t cnt, block_sector_t *sectorp)
+free_map_allocate (size_t cnt, block_sector_t goal, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  /************************ NEW CODE ***************************/
+  lock_acquire (&free_map_lock);
+  if (goal >= bitmap_size (free_map))
+    goal = 0;
+  block_sector_t sector = free_map_find (goal, cnt);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      ASSERT (bitmap_none (free_map, sector, cnt));
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      free_tree_update (sector, cnt);
+      free_cnt -= cnt;
+      group_count (sector, cnt, -1);
+      free_map_mark_dirty (sector, cnt);
     }
+  lock_release (&free_map_lock);
+  /********************** END NEW CODE *************************/
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
@@ -44,10 +318,103 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  /************************ NEW CODE ***************************/
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  free_tree_update (sector, cnt);
+  free_cnt += cnt;
+  group_count (sector, cnt, +1);
+  free_map_mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+  /********************** END NEW CODE *************************/
+}
+
+/************************ NEW CODE ***************************/
+/* Returns the number of free sectors, without looking at the
+   bitmap. */
+size_t
+free_map_free_cnt (void)
+{
+  return free_cnt;
+}
+
+/* Returns a goal sector for the inode of a new directory: the start
+   of the block group with the most free sectors, so directories
+   spread across the disk and each leaves room around it for the
+   files that will go in it. */
+block_sector_t
+free_map_dir_goal (void)
+{
+  size_t best = 0;
+  lock_acquire (&free_map_lock);
+  for (size_t i = 1; i < group_cnt; i++)
+    if (group_free[i] > group_free[best])
+      best = i;
+  lock_release (&free_map_lock);
+  return best * FREE_MAP_GROUP_SECTORS;
+}
+
+/* Prints the free sectors and the longest run of them, which the
+   free-extent index has at its root. */
+void
+free_map_print_stats (void)
+{
+  lock_acquire (&free_map_lock);
+  printf ("Free map: %zu of %zu sectors free, longest free run %"PRIu32
+          " sectors\n", free_cnt, bitmap_size (free_map), free_tree[1].max);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file whose bits changed since
+   they were last written, one file_write_at() per run of such
+   sectors, instead of the whole free map on every change.  The
+   writes land in the buffer cache, so the write-behind thread and
+   sync call this just before flushing the cache, and the free map
+   reaches the disk in the same flush as the inodes and data that
+   use the sectors.  If WAIT is false and another thread is flushing
+   the free map already, returns at once: the write-behind thread
+   must not wait on a flusher that may be throttled waiting for it. */
+void
+free_map_flush (bool wait)
+{
+  if (wait)
+    lock_acquire (&free_map_flush_lock);
+  else if (!lock_try_acquire (&free_map_flush_lock))
+    return;
+  if (free_map_file == NULL)
+    {
+      lock_release (&free_map_flush_lock);
+      return;
+    }
+
+  size_t dirty_cnt = bitmap_size (free_map_dirty);
+  size_t start = 0;
+  while (true)
+    {
+      lock_acquire (&free_map_lock);
+      start = bitmap_scan (free_map_dirty, start, 1, true);
+      if (start == BITMAP_ERROR)
+        {
+          lock_release (&free_map_lock);
+          break;
+        }
+      size_t end = start + 1;
+      while (end < dirty_cnt && bitmap_test (free_map_dirty, end))
+        end++;
+      // clear before writing, so bits changed while the run is being
+      // written mark it again
+      bitmap_set_multiple (free_map_dirty, start, end - start, false);
+      lock_release (&free_map_lock);
+
+      bitmap_write_part (free_map, free_map_file,
+                         start * BLOCK_SECTOR_SIZE,
+                         (end - start) * BLOCK_SECTOR_SIZE);
+      start = end;
+    }
+  lock_release (&free_map_flush_lock);
 }
+/********************** END NEW CODE *************************/
 
 /* Opens the free map file and reads it from disk. */
 void
@@ -58,13 +425,26 @@ free_map_open (void)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  /************************ NEW CODE ***************************/
+  lock_acquire (&free_map_lock);
+  free_tree_build ();
+  lock_release (&free_map_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  /************************ NEW CODE ***************************/
+  free_map_flush (true);
+  // under the flush lock, so the write-behind thread doesn't flush
+  // into the file as it goes
+  lock_acquire (&free_map_flush_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_flush_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -82,4 +462,7 @@ free_map_create (void)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  /************************ NEW CODE ***************************/
+  bitmap_set_all (free_map_dirty, false);
+  /********************** END NEW CODE *************************/
 }
@@ -1,6 +1,7 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
 #include <stdio.h>
+#include <round.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
@@ -67,6 +68,10 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sectors of file data fsutil_extract() reads from the scratch
+   device at a time. */
+#define EXTRACT_CHUNK (PGSIZE / BLOCK_SECTOR_SIZE)
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -79,7 +84,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = malloc (EXTRACT_CHUNK * BLOCK_SECTOR_SIZE);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -124,13 +129,16 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, EXTRACT_CHUNK sectors per disk command. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
+              int chunk_size = (size > EXTRACT_CHUNK * BLOCK_SECTOR_SIZE
+                                ? EXTRACT_CHUNK * BLOCK_SECTOR_SIZE
                                 : size);
-              block_read (src, sector++, data);
+              size_t chunk_sectors = DIV_ROUND_UP (chunk_size,
+                                                   BLOCK_SECTOR_SIZE);
+              block_read_multiple (src, sector, chunk_sectors, data);
+              sector += chunk_sectors;
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
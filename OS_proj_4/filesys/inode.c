@@ -1,12 +1,14 @@
 #include "filesys/inode.h"
 #include <stdio.h>
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include "filesys/cache.h"
 
 /* Identifies an inode. */
@@ -15,8 +17,69 @@
 #define INODE_TABLE_LENGTH 128
 #define INODE_DIRECT_N 8
 #define INODE_INDIRECT_N 32
+// extents kept in the inode itself, in the space of the direct and
+// indirect blocks of the old layout
+#define INODE_EXTENT_N 20
+// extent tables an inode points to itself, and extents per table
+#define INODE_EXTENT_TABLE_N 36
+#define EXTENT_TABLE_LENGTH 64
+// index blocks an inode points to for its further extent tables, and
+// tables per index block. With them an inode maps 20 + 36 * 64 +
+// 4 * 64 * 64 = 18708 extents, so even a file of single-sector runs
+// can outgrow the 8 + 32 * 128 sectors of the indirect layout
+#define INODE_EXTENT_INDEX_N 4
+#define EXTENT_INDEX_LENGTH 64
+// most sectors an extent-mapped file reserves past its end when it
+// grows, so the next appends continue the same run
+#define GROW_RESERVE_MAX 64
+// read-ahead window, in blocks, for a reader that has just turned
+// sequential, and the most it grows to
+#define READ_AHEAD_MIN 2
+#define READ_AHEAD_MAX 16
+// closed inodes kept in memory in case they are opened again soon
+#define INODE_CLOSED_MAX 32
 
 static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Layouts of the block map of an inode.  INODE_INDIRECT is the
+   original one, with direct and singly-indirect blocks, and is
+   what the format field of a disk made before it existed reads
+   as.  INODE_EXTENT maps each run of consecutive sectors with one
+   extent, up to 18708 runs: a file in long runs may grow as large
+   as the disk, and one whose every sector is a run of its own to
+   over 9 MB. */
+enum inode_format
+  {
+    INODE_INDIRECT,                     /* Direct and indirect blocks. */
+    INODE_EXTENT                        /* Extents. */
+  };
+
+/* A run of COUNT consecutive sectors starting at START, mapping
+   the file blocks following those of the extents before it. */
+struct inode_extent
+  {
+    block_sector_t start;               /* First sector of the run. */
+    uint32_t count;                     /* Number of sectors. */
+  };
+
+/* An extent table past the INODE_EXTENT_TABLE_N of the inode, in
+   an index block, and the first file block it maps. */
+struct extent_table_ref
+  {
+    block_sector_t sector;              /* Sector of the table. */
+    uint32_t first;                     /* First file block mapped. */
+  };
+
+// the layout that inode_create() gives new inodes
+static enum inode_format inode_format = INODE_EXTENT;
+
+// sectors files grew by, the runs they were allocated in, and the
+// runs that did not follow the file's previous sector on disk
+static unsigned long long grow_sectors;
+static unsigned long long grow_runs;
+static unsigned long long grow_fragments;
+// guards the three counters above, as files grow side by side
+static struct lock grow_stats_lock;
 /********************** END NEW CODE *************************/
 
 /* On-disk inode.
@@ -25,16 +88,40 @@ struct inode_disk
   {
     // block_sector_t start;               /* First data sector. */
     /************************ NEW CODE ***************************/
-    // direct blocks
-    block_sector_t direct_blocks[INODE_DIRECT_N];
-    // indirect blocks
-    block_sector_t indirect_blocks[INODE_INDIRECT_N];
+    union
+      {
+        /* INODE_INDIRECT. */
+        struct
+          {
+            // direct blocks
+            block_sector_t direct_blocks[INODE_DIRECT_N];
+            // indirect blocks
+            block_sector_t indirect_blocks[INODE_INDIRECT_N];
+          };
+        /* INODE_EXTENT: the first extents, in file order. */
+        struct inode_extent extents[INODE_EXTENT_N];
+      };
     // whether it's a dir
     bool is_dir;
     /********************** END NEW CODE *************************/
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[85];               /* Not used. */
+    /************************ NEW CODE ***************************/
+    uint32_t format;                    /* enum inode_format. */
+    /* INODE_EXTENT only: extents in use, the file blocks they map,
+       past the end of file if some are reserved, and the tables
+       holding those past the first INODE_EXTENT_N, each with the
+       first file block it maps.  Tables past INODE_EXTENT_TABLE_N
+       are listed in index blocks, each with the first file block of
+       its first table. */
+    uint32_t extent_cnt;
+    uint32_t extent_blocks;
+    block_sector_t extent_tables[INODE_EXTENT_TABLE_N];
+    uint32_t extent_table_first[INODE_EXTENT_TABLE_N];
+    block_sector_t extent_indexes[INODE_EXTENT_INDEX_N];
+    uint32_t extent_index_first[INODE_EXTENT_INDEX_N];
+    /********************** END NEW CODE *************************/
+    uint32_t unused[2];                 /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -48,12 +135,40 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    // struct list_elem elem;              /* Element in inode list. */
+    /************************ NEW CODE ***************************/
+    struct hash_elem elem;              /* Element in open_inodes. */
+    struct list_elem closed_elem;       /* Element in closed_inodes. */
+    /********************** END NEW CODE *************************/
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise.*/
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
     struct inode_disk data;             /* Inode content. */
+    /************************ NEW CODE ***************************/
+    // last block read, to tell sequential reads from random ones
+    size_t ra_last;
+    // how many blocks past ra_last to keep prefetched, 0 if random
+    size_t ra_window;
+    // first block not yet handed to the read-ahead thread
+    size_t ra_end;
+    /* Reader/writer lock on DATA: held shared to map and copy file
+       blocks, exclusive to change the block map or the length.
+       RW_LOCK guards READERS and WRITING, and RW_COND is signaled
+       when either drops. */
+    struct lock rw_lock;
+    struct condition rw_cond;
+    int readers;
+    bool writing;
+    // held by a write past end of file from growing the block map
+    // until its data is in, so only one write extends at a time
+    struct lock grow_lock;
+    // length readers see: the old one while a write extends the
+    // file, so they never read the zeroed sectors before the data
+    off_t read_length;
+    // serializes changes to the entries of a directory
+    struct lock dir_lock;
+    /********************** END NEW CODE *************************/
   };
 
 /************************ NEW CODE ***************************/
@@ -64,6 +179,502 @@ get_direct_i(off_t pos)
   direct_block_i = direct_block_i < 8 ? direct_block_i : -1;
   return direct_block_i;
 }
+
+/* Returns the number of extent tables DISK uses. */
+static size_t
+extent_table_cnt (const struct inode_disk *disk)
+{
+  if (disk->extent_cnt <= INODE_EXTENT_N)
+    return 0;
+  return DIV_ROUND_UP (disk->extent_cnt - INODE_EXTENT_N,
+                       EXTENT_TABLE_LENGTH);
+}
+
+/* Returns the number of index blocks DISK uses. */
+static size_t
+extent_index_cnt (const struct inode_disk *disk)
+{
+  size_t table_cnt = extent_table_cnt (disk);
+  if (table_cnt <= INODE_EXTENT_TABLE_N)
+    return 0;
+  return DIV_ROUND_UP (table_cnt - INODE_EXTENT_TABLE_N,
+                       EXTENT_INDEX_LENGTH);
+}
+
+/* Returns the sector of extent table T of DISK, reading it from its
+   index block if it's past those in the inode. */
+static block_sector_t
+extent_table_sector (const struct inode_disk *disk, size_t t)
+{
+  if (t < INODE_EXTENT_TABLE_N)
+    return disk->extent_tables[t];
+  t -= INODE_EXTENT_TABLE_N;
+  int cache_id = cache_get (disk->extent_indexes[t / EXTENT_INDEX_LENGTH],
+                            false);
+  const struct extent_table_ref *index = cache_data (cache_id);
+  block_sector_t sector = index[t % EXTENT_INDEX_LENGTH].sector;
+  cache_put (cache_id, false);
+  return sector;
+}
+
+/* Returns the position of the last of the CNT ascending first blocks
+   at FIRSTS, STRIDE bytes apart, that is not above BLOCK, or 0 if
+   none is. */
+static size_t
+extent_first_find (const void *firsts, size_t stride, size_t cnt,
+                   size_t block)
+{
+  size_t lo = 0, hi = cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (*(const uint32_t *) ((const uint8_t *) firsts + mid * stride)
+          <= block)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Returns the extent table of DISK that maps BLOCK, which is past
+   the extents in the inode, and sets *SECTOR to where the table is
+   and *FIRST to the first block it maps.  Reads at most one index
+   block. */
+static size_t
+extent_table_find (const struct inode_disk *disk, size_t block,
+                   block_sector_t *sector, uint32_t *first)
+{
+  size_t table_cnt = extent_table_cnt (disk);
+  if (table_cnt > INODE_EXTENT_TABLE_N
+      && disk->extent_index_first[0] <= block)
+    {
+      size_t k = extent_first_find (disk->extent_index_first,
+                                    sizeof *disk->extent_index_first,
+                                    extent_index_cnt (disk), block);
+      size_t cnt = table_cnt - INODE_EXTENT_TABLE_N
+                   - k * EXTENT_INDEX_LENGTH;
+      if (cnt > EXTENT_INDEX_LENGTH)
+        cnt = EXTENT_INDEX_LENGTH;
+      int cache_id = cache_get (disk->extent_indexes[k], false);
+      const struct extent_table_ref *index = cache_data (cache_id);
+      size_t i = extent_first_find (&index[0].first, sizeof *index, cnt,
+                                    block);
+      *sector = index[i].sector;
+      *first = index[i].first;
+      cache_put (cache_id, false);
+      return INODE_EXTENT_TABLE_N + k * EXTENT_INDEX_LENGTH + i;
+    }
+
+  if (table_cnt > INODE_EXTENT_TABLE_N)
+    table_cnt = INODE_EXTENT_TABLE_N;
+  size_t t = extent_first_find (disk->extent_table_first,
+                                sizeof *disk->extent_table_first,
+                                table_cnt, block);
+  *sector = disk->extent_tables[t];
+  *first = disk->extent_table_first[t];
+  return t;
+}
+
+/* Starts extent table T of DISK, its first file block FIRST, in a
+   sector near GOAL, along with the index block to list it in if it's
+   the first of one.  Returns false if T is past the reach of the
+   index blocks or no sector is left. */
+static bool
+extent_table_add (struct inode_disk *disk, size_t t, size_t first,
+                  block_sector_t goal)
+{
+  block_sector_t sector;
+  if (t >= INODE_EXTENT_TABLE_N + INODE_EXTENT_INDEX_N * EXTENT_INDEX_LENGTH
+      || !free_map_allocate (1, goal, &sector))
+    return false;
+  cache_write (sector, zeros);
+  if (t < INODE_EXTENT_TABLE_N)
+    {
+      disk->extent_tables[t] = sector;
+      disk->extent_table_first[t] = first;
+      return true;
+    }
+
+  t -= INODE_EXTENT_TABLE_N;
+  size_t k = t / EXTENT_INDEX_LENGTH;
+  if (t % EXTENT_INDEX_LENGTH == 0)
+    {
+      // the index blocks so far are full, start another
+      if (!free_map_allocate (1, sector, &disk->extent_indexes[k]))
+        {
+          free_map_release (sector, 1);
+          return false;
+        }
+      cache_write (disk->extent_indexes[k], zeros);
+      disk->extent_index_first[k] = first;
+    }
+  int cache_id = cache_get (disk->extent_indexes[k], true);
+  struct extent_table_ref *index = cache_data (cache_id);
+  index[t % EXTENT_INDEX_LENGTH].sector = sector;
+  index[t % EXTENT_INDEX_LENGTH].first = first;
+  cache_put (cache_id, true);
+  return true;
+}
+
+/* Releases extent table T of DISK, the last one, which has just lost
+   its last extent, and the index block listing it if it was the
+   only table left there. */
+static void
+extent_table_drop (struct inode_disk *disk, size_t t)
+{
+  free_map_release (extent_table_sector (disk, t), 1);
+  if (t >= INODE_EXTENT_TABLE_N
+      && (t - INODE_EXTENT_TABLE_N) % EXTENT_INDEX_LENGTH == 0)
+    free_map_release (disk->extent_indexes[(t - INODE_EXTENT_TABLE_N)
+                                           / EXTENT_INDEX_LENGTH], 1);
+}
+
+/* Returns extent IDX of DISK.  If it lives in an extent table,
+   the table is pinned in the cache, for writing if WRITE, and
+   *CACHE_ID is set for cache_put(); otherwise *CACHE_ID is -1. */
+static struct inode_extent *
+extent_get (struct inode_disk *disk, size_t idx, bool write,
+            int *cache_id)
+{
+  ASSERT (idx < disk->extent_cnt);
+  if (idx < INODE_EXTENT_N)
+    {
+      *cache_id = -1;
+      return &disk->extents[idx];
+    }
+  idx -= INODE_EXTENT_N;
+  *cache_id = cache_get (extent_table_sector (disk,
+                                              idx / EXTENT_TABLE_LENGTH),
+                         write);
+  struct inode_extent *table = cache_data (*cache_id);
+  return &table[idx % EXTENT_TABLE_LENGTH];
+}
+
+/* Returns the sector holding file block BLOCK of the extent-mapped
+   DISK, or -1 if no extent maps it.  The extents in the inode are
+   walked in order; past them, the table to look in is found by
+   binary search on the first block of each table, so at most one
+   index block and one table are read. */
+static block_sector_t
+extent_lookup (const struct inode_disk *disk, size_t block)
+{
+  size_t inline_cnt = disk->extent_cnt < INODE_EXTENT_N ?
+                      disk->extent_cnt : INODE_EXTENT_N;
+  size_t first = 0;
+  for (size_t i = 0; i < inline_cnt; i++)
+    {
+      const struct inode_extent *e = &disk->extents[i];
+      if (block < first + e->count)
+        return e->start + (block - first);
+      first += e->count;
+    }
+
+  if (extent_table_cnt (disk) == 0)
+    return -1;
+  // the last table starting at or before BLOCK
+  block_sector_t sector;
+  uint32_t table_first;
+  size_t t = extent_table_find (disk, block, &sector, &table_first);
+  size_t cnt = disk->extent_cnt - INODE_EXTENT_N - t * EXTENT_TABLE_LENGTH;
+  if (cnt > EXTENT_TABLE_LENGTH)
+    cnt = EXTENT_TABLE_LENGTH;
+
+  block_sector_t result = -1;
+  first = table_first;
+  int cache_id = cache_get (sector, false);
+  const struct inode_extent *table = cache_data (cache_id);
+  for (size_t i = 0; i < cnt; i++)
+    {
+      if (block < first + table[i].count)
+        {
+          result = table[i].start + (block - first);
+          break;
+        }
+      first += table[i].count;
+    }
+  cache_put (cache_id, false);
+  return result;
+}
+
+/* Returns the sector holding file block BLOCK of DISK, in
+   whichever layout DISK has.  BLOCK must be mapped. */
+static block_sector_t
+block_to_sector (const struct inode_disk *disk, size_t block)
+{
+  if (disk->format == INODE_EXTENT)
+    return extent_lookup (disk, block);
+  if (block < INODE_DIRECT_N)
+    {
+      // block is a direct block
+      return disk->direct_blocks[block];
+    }
+  // block is in indirect block
+  block -= INODE_DIRECT_N;
+  ASSERT (block < INODE_INDIRECT_N * INODE_TABLE_LENGTH);
+
+  // look the entry up in place in the cached table
+  int cache_id = cache_get (disk->indirect_blocks[block / INODE_TABLE_LENGTH],
+                            false);
+  block_sector_t *table = cache_data (cache_id);
+  block_sector_t result = table[block % INODE_TABLE_LENGTH];
+  cache_put (cache_id, false);
+  return result;
+}
+
+/* Maps file block BLOCK, the one after the last mapped, of the
+   extent-mapped DISK to SECTOR, lengthening the last extent if
+   SECTOR follows it.  Returns false if a new extent is needed and
+   there is no room or no sector for another extent table. */
+static bool
+extent_append (struct inode_disk *disk, size_t block, block_sector_t sector)
+{
+  int cache_id;
+  if (disk->extent_cnt > 0)
+    {
+      struct inode_extent *last = extent_get (disk, disk->extent_cnt - 1,
+                                              true, &cache_id);
+      bool merged = last->start + last->count == sector;
+      if (merged)
+        last->count++;
+      if (cache_id != -1)
+        cache_put (cache_id, merged);
+      if (merged)
+        {
+          disk->extent_blocks++;
+          return true;
+        }
+    }
+
+  size_t idx = disk->extent_cnt;
+  if (idx >= INODE_EXTENT_N
+      && (idx - INODE_EXTENT_N) % EXTENT_TABLE_LENGTH == 0)
+    {
+      // the tables so far are full, start another
+      if (!extent_table_add (disk, (idx - INODE_EXTENT_N)
+                                   / EXTENT_TABLE_LENGTH, block, sector))
+        return false;
+    }
+  disk->extent_cnt++;
+  disk->extent_blocks++;
+  struct inode_extent *e = extent_get (disk, idx, true, &cache_id);
+  e->start = sector;
+  e->count = 1;
+  if (cache_id != -1)
+    cache_put (cache_id, true);
+  return true;
+}
+
+/* Unmaps and releases the blocks of the extent-mapped DISK from
+   BLOCKS on, the ones reserved past the end of file. */
+static void
+extent_trim (struct inode_disk *disk, size_t blocks)
+{
+  while (disk->extent_blocks > blocks)
+    {
+      int cache_id;
+      struct inode_extent *last = extent_get (disk, disk->extent_cnt - 1,
+                                              true, &cache_id);
+      size_t drop = disk->extent_blocks - blocks;
+      if (drop > last->count)
+        drop = last->count;
+      last->count -= drop;
+      block_sector_t start = last->start + last->count;
+      bool empty = last->count == 0;
+      if (cache_id != -1)
+        cache_put (cache_id, true);
+
+      free_map_release (start, drop);
+      disk->extent_blocks -= drop;
+      if (empty)
+        {
+          size_t idx = --disk->extent_cnt;
+          // the last extent of its table went, and the table with it
+          if (idx >= INODE_EXTENT_N
+              && (idx - INODE_EXTENT_N) % EXTENT_TABLE_LENGTH == 0)
+            extent_table_drop (disk, (idx - INODE_EXTENT_N)
+                                     / EXTENT_TABLE_LENGTH);
+        }
+    }
+}
+
+/* Maps file block BLOCK of the indirect-mapped DISK to SECTOR,
+   starting a new indirect table if BLOCK is the first of one.
+   Returns false if BLOCK is past the reach of the indirect
+   blocks or no sector is left for the table. */
+static bool
+indirect_map (struct inode_disk *disk, size_t block, block_sector_t sector)
+{
+  if (block < INODE_DIRECT_N)
+    {
+      disk->direct_blocks[block] = sector;
+      return true;
+    }
+  block -= INODE_DIRECT_N;
+  size_t indirect_i = block / INODE_TABLE_LENGTH;
+  if (indirect_i >= INODE_INDIRECT_N)
+    return false;
+  if (block % INODE_TABLE_LENGTH == 0)
+    {
+      if (!free_map_allocate (1, sector,
+                              &disk->indirect_blocks[indirect_i]))
+        return false;
+      cache_write (disk->indirect_blocks[indirect_i], zeros);
+    }
+
+  // patch the entry into the cached table in place
+  int cache_id = cache_get (disk->indirect_blocks[indirect_i], true);
+  block_sector_t *table = cache_data (cache_id);
+  table[block % INODE_TABLE_LENGTH] = sector;
+  cache_put (cache_id, true);
+  return true;
+}
+
+/* Allocates a run of consecutive free sectors at or after GOAL, as
+   many as CNT if there is such a run, or else half as many, and so
+   on, so that a fragmented disk still yields the longest run it
+   easily can.  Stores the first sector in *SECTOR and returns the
+   length of the run, 0 if the disk is full. */
+static size_t
+grow_allocate (size_t cnt, block_sector_t goal, block_sector_t *sector)
+{
+  for (; cnt > 0; cnt /= 2)
+    if (free_map_allocate (cnt, goal, sector))
+      return cnt;
+  return 0;
+}
+
+/* Grows DISK to LENGTH bytes, mapping the sectors past its end in
+   runs of consecutive sectors and zeroing them.  An extent-mapped
+   DISK also reserves up to GROW_RESERVE_MAX sectors past LENGTH if
+   RESERVE, so that appends in small writes, or from two files at
+   once, still get long runs; a later grow uses the reserved
+   sectors first, and inode_close() gives back those left.  Each
+   run is sought right after the last sector of the file, or after
+   the inode at SECTOR for its first, keeping a file next to its
+   inode and in one piece where the disk allows.  On failure DISK
+   is grown as far as it could be and stays consistent.  Returns
+   whether all of LENGTH was reached. */
+static bool
+inode_grow (struct inode_disk *disk, block_sector_t sector, off_t length,
+            bool reserve)
+{
+  size_t sectors_cur = bytes_to_sectors (disk->length);
+  size_t sectors_new = bytes_to_sectors (length);
+  bool extent = disk->format == INODE_EXTENT;
+  size_t mapped = extent ? disk->extent_blocks : sectors_cur;
+  block_sector_t last = mapped > 0 ? block_to_sector (disk, mapped - 1)
+                                    : sector;
+
+  bool success = true;
+  while (mapped < sectors_new)
+    {
+      size_t want = sectors_new - mapped;
+      if (extent && reserve)
+        want += sectors_new < GROW_RESERVE_MAX ?
+                sectors_new : GROW_RESERVE_MAX;
+      block_sector_t start;
+      size_t cnt = grow_allocate (want, last + 1, &start);
+      if (cnt == 0)
+        {
+          success = false;
+          break;
+        }
+      lock_acquire (&grow_stats_lock);
+      grow_sectors += cnt;
+      grow_runs++;
+      if (mapped == 0 || start != last + 1)
+        grow_fragments++;
+      lock_release (&grow_stats_lock);
+
+      size_t i;
+      for (i = 0; i < cnt; i++)
+        if (!(extent ? extent_append (disk, mapped + i, start + i) :
+                       indirect_map (disk, mapped + i, start + i)))
+          break;
+      if (i < cnt)
+        {
+          free_map_release (start + i, cnt - i);
+          mapped += i;
+          success = false;
+          break;
+        }
+      mapped += cnt;
+      last = start + cnt - 1;
+    }
+
+  // zero the sectors now inside the file, reserved ones included
+  size_t sectors_end = mapped < sectors_new ? mapped : sectors_new;
+  for (size_t i = sectors_cur; i < sectors_end; i++)
+    cache_write (block_to_sector (disk, i), zeros);
+  if (success)
+    {
+      if (length > disk->length)
+        disk->length = length;
+    }
+  else if (sectors_end > sectors_cur)
+    disk->length = sectors_end * BLOCK_SECTOR_SIZE;
+  return success;
+}
+
+/* Releases the data sectors of DISK and the sectors of its block
+   map, but not the inode sector itself. */
+static void
+inode_release (struct inode_disk *disk)
+{
+  if (disk->format == INODE_EXTENT)
+    {
+      for (size_t i = 0; i < disk->extent_cnt; i++)
+        {
+          int cache_id;
+          struct inode_extent e = *extent_get (disk, i, false, &cache_id);
+          if (cache_id != -1)
+            cache_put (cache_id, false);
+          // a whole run goes back at once
+          free_map_release (e.start, e.count);
+        }
+      size_t table_cnt = extent_table_cnt (disk);
+      for (size_t i = 0; i < table_cnt; i++)
+        free_map_release (extent_table_sector (disk, i), 1);
+      size_t index_cnt = extent_index_cnt (disk);
+      for (size_t i = 0; i < index_cnt; i++)
+        free_map_release (disk->extent_indexes[i], 1);
+      return;
+    }
+
+  size_t sectors = bytes_to_sectors (disk->length);
+  size_t n_direct_blocks = sectors <= INODE_DIRECT_N ? 
+                            sectors : INODE_DIRECT_N;
+  for (size_t i=0; i<n_direct_blocks; i++)
+    {
+      // make the direct blocks entries available to use
+      free_map_release (disk->direct_blocks[i], 1);
+    }
+  if (sectors <= INODE_DIRECT_N)
+    return;
+
+  size_t n_indirect_blocks = sectors - INODE_DIRECT_N;
+  for (size_t i=0; i<n_indirect_blocks; i+=INODE_TABLE_LENGTH)
+    {
+      size_t indirect_i = i / INODE_TABLE_LENGTH;
+      size_t n_table_entry = 
+        (n_indirect_blocks-i) < INODE_TABLE_LENGTH ?
+        (n_indirect_blocks-i) : INODE_TABLE_LENGTH;
+      for (size_t j=0; j<n_table_entry; j+=1)
+        {
+          // read each entry in place, not holding the table while
+          // the free map is written
+          int cache_id = cache_get (disk->indirect_blocks[indirect_i],
+                                    false);
+          block_sector_t sector = ((block_sector_t *)
+                                   cache_data (cache_id))[j];
+          cache_put (cache_id, false);
+          free_map_release (sector, 1);
+        }
+      // make indirect blocks available to use
+      free_map_release (disk->indirect_blocks[indirect_i], 1);
+    }
+}
 /********************** END NEW CODE *************************/
 
 /* Returns the block device sector that contains byte offset POS
@@ -77,37 +688,7 @@ byte_to_sector (const struct inode *inode, off_t pos)
   if (pos < inode->data.length)
     {
       /************************ NEW CODE ***************************/
-      if (pos < INODE_DIRECT_N * BLOCK_SECTOR_SIZE)
-        {
-          // pos is in direct block
-          int direct_block_i = pos / BLOCK_SECTOR_SIZE;
-          return inode->data.direct_blocks[direct_block_i];
-        }
-      else if (pos < INODE_DIRECT_N * BLOCK_SECTOR_SIZE + 
-        INODE_INDIRECT_N * INODE_TABLE_LENGTH * BLOCK_SECTOR_SIZE)
-        {
-          // pos is in indirect block
-          int indirect_table_i = (pos - INODE_DIRECT_N * BLOCK_SECTOR_SIZE)
-                                / (INODE_TABLE_LENGTH * BLOCK_SECTOR_SIZE);
-          int table_entry_i = (pos - INODE_DIRECT_N * BLOCK_SECTOR_SIZE - 
-                                indirect_table_i * INODE_TABLE_LENGTH 
-                                * BLOCK_SECTOR_SIZE) 
-                                / BLOCK_SECTOR_SIZE;
-
-          block_sector_t *table = calloc(INODE_TABLE_LENGTH, 
-                                          sizeof (block_sector_t*));
-          ASSERT (table != NULL);
-          // read file data into cache buffer
-          cache_read (inode->data.indirect_blocks[indirect_table_i], table);
-          block_sector_t result = table[table_entry_i];
-          free (table);
-          return result;
-        }
-      else
-      {
-        ASSERT (false);
-      }
-      
+      return block_to_sector (&inode->data, pos / BLOCK_SECTOR_SIZE);
       /********************** END NEW CODE *************************/
       // return inode->data.start + pos / BLOCK_SECTOR_SIZE;
     }
@@ -116,115 +697,164 @@ byte_to_sector (const struct inode *inode, off_t pos)
 }
 
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, first growing INODE to hold it if POS is past its
+   end.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS, because it could not be grown. */
 static block_sector_t
 byte_to_sector_write (struct inode *inode, off_t pos) 
 {
   ASSERT (inode != NULL);
-  block_sector_t result;
+  /************************ NEW CODE ***************************/
   // current position is already smaller than length, 
-  // no need to extend into direct/indirect blocks
-  if (pos < inode->data.length)
+  // no need to extend the block map
+  if (pos >= inode->data.length)
     {
-      result = byte_to_sector (inode, pos);
-      return result;
+      bool grown = inode_grow (&inode->data, inode->sector, pos + 1, true);
+      // finally write all the data part of the inode into cache
+      // sector, keeping whatever part of the growth did succeed
+      cache_write (inode->sector, &inode->data);
+      if (!grown)
+        return -1;
     }
+  return byte_to_sector (inode, pos);
+  /********************** END NEW CODE *************************/
+}
+
+/************************ NEW CODE ***************************/
+/* Sets the layout of the block map of inodes made from now on,
+   "extent" or "indirect".  Returns false if NAME is unknown. */
+bool
+inode_set_format (const char *name)
+{
+  if (!strcmp (name, "extent"))
+    inode_format = INODE_EXTENT;
+  else if (!strcmp (name, "indirect"))
+    inode_format = INODE_INDIRECT;
   else
-    {
-      size_t sectors_cur = bytes_to_sectors (inode->data.length);
-      size_t sectors_new = bytes_to_sectors (pos+1);
-      // within the reach of direct blocks
-      if (sectors_cur < INODE_DIRECT_N)
-        {
-          size_t sectors_direct_new = sectors_new < INODE_DIRECT_N ?
-                                      sectors_new : INODE_DIRECT_N;
-          for (size_t i=sectors_cur; i<sectors_direct_new; i++)
-            {
-              // allocate the bitmap and write into cache buffer
-              if (!free_map_allocate (1, &inode->data.direct_blocks[i]))
-                return -1;
-              cache_write (inode->data.direct_blocks[i], zeros);
-            }
-        }
+    return false;
+  return true;
+}
 
-      if (sectors_new <= INODE_DIRECT_N)
-        {
-          inode->data.length = pos+1;
-          cache_write (inode->sector, &inode->data);
-          return inode->data.direct_blocks[sectors_new-1];
-        }
-      // cases when sector_new is even larger than direct block's range
-      // get into indirect blocks
-      size_t sectors_indirect_cur = sectors_cur > INODE_DIRECT_N ?
-                                    sectors_cur-INODE_DIRECT_N : 0;
-      size_t table_n_old = (sectors_indirect_cur+INODE_TABLE_LENGTH-1) 
-                            / INODE_TABLE_LENGTH;  // how many tables
-      size_t sectors_indirect_new = sectors_new - INODE_DIRECT_N;
-      block_sector_t *table = calloc(INODE_TABLE_LENGTH, 
-                                      sizeof (block_sector_t*));
-      ASSERT (table != NULL);
-      for (size_t i= (sectors_indirect_cur/ INODE_TABLE_LENGTH)*
-                  INODE_TABLE_LENGTH; 
-            i<sectors_indirect_new; i+=INODE_TABLE_LENGTH)
-        {
-          size_t off_i;
-          size_t indirect_i = i / INODE_TABLE_LENGTH;
-          // check if we need a new table
-          if (indirect_i+1 > table_n_old) 
-            {
-              if (!free_map_allocate (1, 
-                    &inode->data.indirect_blocks[indirect_i])) 
-                {
-                  free (table);
-                  return -1;
-                }
-              memset (table, 0, BLOCK_SECTOR_SIZE);
-              off_i = 0;
-            }
-          else
-            {
-              // read from cache to memory the original indirect blocks
-              cache_read (inode->data.indirect_blocks[indirect_i], table);
-              off_i = sectors_indirect_cur % INODE_TABLE_LENGTH;
-            }
-          
-          size_t n_table_entry = 
-            (sectors_indirect_new-i) < INODE_TABLE_LENGTH ?
-            (sectors_indirect_new-i) : INODE_TABLE_LENGTH;
-          
-          for (size_t j=off_i; j<n_table_entry; j+=1)
-            {
-              if (!free_map_allocate (1, &table[j]))
-                {
-                  free (table);
-                  return -1;
-                }
-              cache_write (table[j], zeros);
-            }
-          // write table back into cache
-          // given the indirect index
-          cache_write (inode->data.indirect_blocks[indirect_i], table);
-        }
-      result = table[(sectors_indirect_new-1)%INODE_TABLE_LENGTH];
+/* Prints how many sectors files grew by and how fragmented they
+   came out: the runs of consecutive sectors they were allocated
+   in, and how many of those did not follow the file's previous
+   sector on disk. */
+void
+inode_print_stats (void)
+{
+  printf ("Allocation: %llu sectors in %llu runs, %llu fragments, "
+          "%llu sectors per fragment\n", grow_sectors, grow_runs,
+          grow_fragments,
+          grow_fragments > 0 ? grow_sectors / grow_fragments : 0);
+}
 
-      free (table);
-    }
-    inode->data.length = pos+1;
-    // finally write all the data part of the inode into cache sector
-    cache_write (inode->sector, &inode->data);
-    return result;
+/* Gives inodes made from now on the layout of the inode at SECTOR,
+   so that a file system keeps the layout it was formatted with. */
+void
+inode_adopt_format (block_sector_t sector)
+{
+  int cache_id = cache_get (sector, false);
+  const struct inode_disk *disk = cache_data (cache_id);
+  inode_format = disk->format;
+  cache_put (cache_id, false);
+}
+/********************** END NEW CODE *************************/
+
+/************************ NEW CODE ***************************/
+/* Takes INODE's reader/writer lock shared, waiting out a writer. */
+static void
+inode_lock_shared (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  while (inode->writing)
+    cond_wait (&inode->rw_cond, &inode->rw_lock);
+  inode->readers++;
+  lock_release (&inode->rw_lock);
 }
+
+/* Drops a shared hold on INODE's reader/writer lock. */
+static void
+inode_unlock_shared (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  ASSERT (inode->readers > 0);
+  if (--inode->readers == 0)
+    cond_broadcast (&inode->rw_cond, &inode->rw_lock);
+  lock_release (&inode->rw_lock);
+}
+
+/* Takes INODE's reader/writer lock exclusive, waiting out readers
+   and any other writer. */
+static void
+inode_lock_exclusive (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  while (inode->writing || inode->readers > 0)
+    cond_wait (&inode->rw_cond, &inode->rw_lock);
+  inode->writing = true;
+  lock_release (&inode->rw_lock);
+}
+
+/* Drops an exclusive hold on INODE's reader/writer lock. */
+static void
+inode_unlock_exclusive (struct inode *inode)
+{
+  lock_acquire (&inode->rw_lock);
+  ASSERT (inode->writing);
+  inode->writing = false;
+  cond_broadcast (&inode->rw_cond, &inode->rw_lock);
+  lock_release (&inode->rw_lock);
+}
+/********************** END NEW CODE *************************/
+
 /* List of open inodes, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+// static struct list open_inodes;
+/************************ NEW CODE ***************************/
+/* Open inodes, and the INODE_CLOSED_MAX most recently closed
+   ones, hashed by sector, so that opening a single inode twice
+   returns the same `struct inode' without a walk over every open
+   file.  A closed inode, open_cnt 0, is also in closed_inodes,
+   most recently closed first; opening it again takes it back with
+   its inode_disk already read. */
+static struct hash open_inodes;
+static struct list closed_inodes;
+static size_t closed_cnt;
+// guards open_inodes, closed_inodes and the open_cnt of every inode
+static struct lock open_inodes_lock;
+
+/* Hash function for open_inodes. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_int (inode->sector);
+}
+
+/* Orders open_inodes by sector. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return hash_entry (a, struct inode, elem)->sector
+         < hash_entry (b, struct inode, elem)->sector;
+}
+/********************** END NEW CODE *************************/
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  // list_init (&open_inodes);
+  /************************ NEW CODE ***************************/
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("can't create open inode table");
+  list_init (&closed_inodes);
+  closed_cnt = 0;
+  lock_init (&open_inodes_lock);
+  lock_init (&grow_stats_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -247,74 +877,21 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
       // if (free_map_allocate (sectors, &disk_inode->start)) 
       // if (free_map_allocate (1, &disk_inode->direct_blocks[0])) 
       //   {
-        /************************ NEW CODE ***************************/
-      // similar as above 
+      /************************ NEW CODE ***************************/
       disk_inode->is_dir = false;
-      size_t n_direct_blocks = sectors < INODE_DIRECT_N ? 
-                                sectors : INODE_DIRECT_N;
-      for (size_t i=0; i<n_direct_blocks; i++)
-        {
-          if (!free_map_allocate (1, &disk_inode->direct_blocks[i]))
-            {
-              // if it's not allocated yet
-              free (disk_inode);
-              return false;
-            }
-          // write zeros
-          cache_write (disk_inode->direct_blocks[i], zeros);
-        }
-
-      if (sectors <= INODE_DIRECT_N)
-        {
-          // within direct blocks
-          cache_write (sector, disk_inode);
-          free (disk_inode);
-          return true;
-        }
-      size_t n_indirect_blocks = sectors - INODE_DIRECT_N;
-      block_sector_t *table = calloc(INODE_TABLE_LENGTH, 
-                                      sizeof (block_sector_t*));
-      ASSERT (table != NULL);
-
-      for (size_t i=0; i<n_indirect_blocks; i+=INODE_TABLE_LENGTH)
-        {
-          size_t indirect_i = i / INODE_TABLE_LENGTH;
-          if (!free_map_allocate (1, 
-                &disk_inode->indirect_blocks[indirect_i])) 
-            {
-              free (disk_inode);
-              free (table);
-              return false;
-            }
-
-          memset (table, 0, BLOCK_SECTOR_SIZE);
-          size_t n_table_entry = 
-            (n_indirect_blocks-i) < INODE_TABLE_LENGTH ?
-            (n_indirect_blocks-i) : INODE_TABLE_LENGTH;
-          for (size_t j=0; j<n_table_entry; j+=1)
-            {
-              if (!free_map_allocate (1, &table[j]))
-                {
-                  free (disk_inode);
-                  free (table);
-                  return false;
-                }
-              cache_write (table[j], zeros);
-            }
-          // write table back into cache
-          // given the indirect index
-          cache_write (disk_inode->indirect_blocks[indirect_i], table);
-        }
-      success = true;
-      free (table);
-      // finally write all the data part of the inode into cache sector
-      cache_write (sector, disk_inode);
+      disk_inode->format = inode_format;
+      // grow from empty, so a failure part way can be undone
+      disk_inode->length = 0;
+      success = inode_grow (disk_inode, sector, length, false);
+      if (success)
+        // finally write all the data part of the inode into cache sector
+        cache_write (sector, disk_inode);
+      else
+        inode_release (disk_inode);
       /********************** END NEW CODE *************************/
       free (disk_inode);
     }
@@ -327,34 +904,71 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  /************************ NEW CODE ***************************/
+  struct inode key;
+  key.sector = sector;
+  lock_acquire (&open_inodes_lock);
+  struct hash_elem *e = hash_find (&open_inodes, &key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, elem);
+      if (inode->open_cnt == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          // recently closed: take it back, inode_disk and all
+          list_remove (&inode->closed_elem);
+          closed_cnt--;
+          inode->ra_last = (size_t) -1;
+          inode->ra_window = 0;
+          inode->ra_end = 0;
         }
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      // wait out the read of its inode_disk if that is still going on
+      inode_lock_shared (inode);
+      inode_unlock_shared (inode);
+      return inode; 
     }
+  /********************** END NEW CODE *************************/
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
+  // if (inode == NULL)
+  //   return NULL;
+  /************************ NEW CODE ***************************/
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
+  /********************** END NEW CODE *************************/
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
   /************************ NEW CODE ***************************/
+  // as if block -1 was just read, so reading from 0 counts as sequential
+  inode->ra_last = (size_t) -1;
+  inode->ra_window = 0;
+  inode->ra_end = 0;
+  lock_init (&inode->rw_lock);
+  cond_init (&inode->rw_cond);
+  inode->readers = 0;
+  lock_init (&inode->grow_lock);
+  lock_init (&inode->dir_lock);
+
+  // publish it held exclusive, so the table lock is not held over
+  // the read and other openers of the sector wait for it instead
+  inode->writing = true;
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   cache_read (inode->sector, &inode->data);
+  inode->read_length = inode->data.length;
+  inode_unlock_exclusive (inode);
   /********************** END NEW CODE *************************/
   // block_read (fs_device, inode->sector, &inode->data);
   return inode;
@@ -364,8 +978,16 @@ inode_open (block_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
+  // if (inode != NULL)
+  //   inode->open_cnt++;
+  /************************ NEW CODE ***************************/
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
+  /********************** END NEW CODE *************************/
   return inode;
 }
 
@@ -387,61 +1009,69 @@ inode_close (struct inode *inode)
     return;
   
   /* Release resources if this was the last opener. */
+  /************************ NEW CODE ***************************/
+  // the last opener gives back the sectors reserved past the end of
+  // file first. It stays counted as open meanwhile, so the inode
+  // can't be dropped from closed_inodes under it, and the table lock
+  // isn't held over the free map and the cache. Whether it is the
+  // last is decided under the same hold of the lock as the decrement,
+  // checking again after each trim in case it was reopened and grown
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && !inode->removed
+         && inode->data.format == INODE_EXTENT
+         && inode->data.extent_blocks > bytes_to_sectors (inode->data.length))
+    {
+      lock_release (&open_inodes_lock);
+      lock_acquire (&inode->grow_lock);
+      inode_lock_exclusive (inode);
+      if (inode->data.extent_blocks > bytes_to_sectors (inode->data.length))
+        {
+          extent_trim (&inode->data, bytes_to_sectors (inode->data.length));
+          cache_write (inode->sector, &inode->data);
+        }
+      inode_unlock_exclusive (inode);
+      lock_release (&inode->grow_lock);
+      lock_acquire (&open_inodes_lock);
+    }
+  /********************** END NEW CODE *************************/
   if (--inode->open_cnt == 0)
     {
       /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      // list_remove (&inode->elem);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           /************************ NEW CODE ***************************/
-          size_t sectors = bytes_to_sectors (inode->data.length);
-          size_t n_direct_blocks = sectors <= INODE_DIRECT_N ? 
-                                    sectors : INODE_DIRECT_N;
-          for (size_t i=0; i<n_direct_blocks; i++)
-            {
-              // make the direct blocks entries available to use
-              free_map_release (inode->data.direct_blocks[i], 1);
-            }
-
-          if (sectors <= INODE_DIRECT_N)
-            {
-              // make inode sectors available to use
-              free_map_release (inode->sector, 1);
-              free (inode);
-              return;
-            }
-
-          size_t n_indirect_blocks = sectors - INODE_DIRECT_N;
-          block_sector_t *table = calloc(INODE_TABLE_LENGTH, 
-                                          sizeof (block_sector_t*));
-          ASSERT (table != NULL);
-
-          for (size_t i=0; i<n_indirect_blocks; i+=INODE_TABLE_LENGTH)
-            {
-              size_t indirect_i = i / INODE_TABLE_LENGTH;
-              // read indirect blocks back into table
-              cache_read (inode->data.indirect_blocks[indirect_i], table);
-              size_t n_table_entry = 
-                (n_indirect_blocks-i) < INODE_TABLE_LENGTH ?
-                (n_indirect_blocks-i) : INODE_TABLE_LENGTH;
-              for (size_t j=0; j<n_table_entry; j+=1)
-                {
-                  free_map_release (table[j], 1);
-                }
-              // make indirect blocks available to use
-              free_map_release (inode->data.indirect_blocks[indirect_i], 1);
-            }
-          free (table);
+          hash_delete (&open_inodes, &inode->elem);
+          lock_release (&open_inodes_lock);
+          inode_release (&inode->data);
           free_map_release (inode->sector, 1);
+          free (inode);
+          return;
           /*********************** END NEW CODE *************************/
           // free_map_release (inode->sector, 1);
           // free_map_release (inode->data.start,
           //                   bytes_to_sectors (inode->data.length)); 
         }
-      free (inode); 
+      /************************ NEW CODE ***************************/
+      // keep it warm in case it's opened again, making room by
+      // dropping the one closed longest ago
+      list_push_front (&closed_inodes, &inode->closed_elem);
+      if (++closed_cnt > INODE_CLOSED_MAX)
+        {
+          struct inode *old = list_entry (list_pop_back (&closed_inodes),
+                                          struct inode, closed_elem);
+          closed_cnt--;
+          hash_delete (&open_inodes, &old->elem);
+          free (old);
+        }
+      /********************** END NEW CODE *************************/
+      // free (inode); 
     }
+  /************************ NEW CODE ***************************/
+  lock_release (&open_inodes_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -450,8 +1080,58 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  /************************ NEW CODE ***************************/
+  lock_acquire (&open_inodes_lock);
+  /********************** END NEW CODE *************************/
   inode->removed = true;
+  /************************ NEW CODE ***************************/
+  lock_release (&open_inodes_lock);
+  /********************** END NEW CODE *************************/
+}
+
+/************************ NEW CODE ***************************/
+/* Records that blocks FIRST through LAST of INODE were just read.
+   A read that starts in or right after the last block read is
+   sequential and doubles the read-ahead window, up to
+   READ_AHEAD_MAX; anything else collapses it.  The blocks of the
+   window not queued yet are resolved through byte_to_sector() and
+   handed to the read-ahead thread.  Called with INODE held shared,
+   so readers may race on the window, which only costs a missed or
+   a wasted prefetch. */
+static void
+read_ahead_update (struct inode *inode, size_t first, size_t last)
+{
+  if (first == inode->ra_last || first == inode->ra_last + 1)
+    {
+      if (inode->ra_window == 0)
+        inode->ra_window = READ_AHEAD_MIN;
+      else if (inode->ra_window < READ_AHEAD_MAX)
+        inode->ra_window *= 2;
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_end = 0;
+    }
+  inode->ra_last = last;
+  if (inode->ra_window == 0)
+    return;
+
+  size_t blocks = bytes_to_sectors (inode_length (inode));
+  size_t end = last + 1 + inode->ra_window;
+  if (end > blocks)
+    end = blocks;
+  size_t b = inode->ra_end > last + 1 ? inode->ra_end : last + 1;
+  for (; b < end; b++)
+    {
+      block_sector_t sector = byte_to_sector (inode, b * BLOCK_SECTOR_SIZE);
+      if (sector == (block_sector_t) -1)
+        break;
+      cache_read_ahead (sector);
+    }
+  inode->ra_end = b;
 }
+/********************** END NEW CODE *************************/
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
@@ -461,8 +1141,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t start = offset;
 
+  /************************ NEW CODE ***************************/
+  inode_lock_shared (inode);
+  /********************** END NEW CODE *************************/
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -479,35 +1162,25 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          /************************ NEW CODE ***************************/
-          cache_read (sector_idx, buffer + bytes_read);
-          /********************** END NEW CODE *************************/
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
       /************************ NEW CODE ***************************/
-          cache_read (sector_idx, bounce);
+      /* Copy straight out of the pinned cache, whole sector or not. */
+      int cache_id = cache_get (sector_idx, false);
+      memcpy (buffer + bytes_read,
+              (uint8_t *) cache_data (cache_id) + sector_ofs, chunk_size);
+      cache_put (cache_id, false);
       /********************** END NEW CODE *************************/
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  /************************ NEW CODE ***************************/
+  if (bytes_read > 0)
+    read_ahead_update (inode, start / BLOCK_SECTOR_SIZE,
+                       (start + bytes_read - 1) / BLOCK_SECTOR_SIZE);
+  inode_unlock_shared (inode);
+  /********************** END NEW CODE *************************/
 
   return bytes_read;
 }
@@ -523,11 +1196,27 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
   if (inode->deny_write_cnt)
     return 0;
-  byte_to_sector_write (inode, offset+size-1);
+  // byte_to_sector_write (inode, offset+size-1);
+  /************************ NEW CODE ***************************/
+  // a write past end of file grows the block map exclusive, then
+  // writes its data shared like any other, still holding grow_lock
+  // so the new length shows only once the data is in
+  bool grow = offset + size > inode_length (inode);
+  if (grow)
+    {
+      lock_acquire (&inode->grow_lock);
+      inode_lock_exclusive (inode);
+      // out of disk space: write only what fits in the file as it
+      // could be grown, a short write
+      if (byte_to_sector_write (inode, offset+size-1) == (block_sector_t) -1)
+        size = inode->data.length > offset ? inode->data.length - offset : 0;
+      inode_unlock_exclusive (inode);
+    }
+  inode_lock_shared (inode);
+  /********************** END NEW CODE *************************/
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
@@ -536,7 +1225,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      // off_t inode_left = inode_length (inode) - offset;
+      /************************ NEW CODE ***************************/
+      off_t inode_left = inode->data.length - offset;
+      /********************** END NEW CODE *************************/
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -554,23 +1246,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         }
       else 
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (sector_idx, bounce);
+          /************************ NEW CODE ***************************/
+          /* The sector contains data before or after the chunk
+             we're writing, so patch the chunk into the pinned cache
+             in place, which reads the sector in on a miss. */
+          int cache_id = cache_get (sector_idx, true);
+          memcpy ((uint8_t *) cache_data (cache_id) + sector_ofs,
+                  buffer + bytes_written, chunk_size);
+          cache_put (cache_id, true);
+          /********************** END NEW CODE *************************/
         }
 
       /* Advance. */
@@ -578,7 +1262,15 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+
+  /************************ NEW CODE ***************************/
+  inode_unlock_shared (inode);
+  if (grow)
+    {
+      inode->read_length = inode->data.length;
+      lock_release (&inode->grow_lock);
+    }
+  /********************** END NEW CODE *************************/
 
   return bytes_written;
 }
@@ -588,8 +1280,14 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  /************************ NEW CODE ***************************/
+  lock_acquire (&inode->rw_lock);
+  /********************** END NEW CODE *************************/
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  /************************ NEW CODE ***************************/
+  lock_release (&inode->rw_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Re-enables writes to INODE.
@@ -598,16 +1296,25 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  /************************ NEW CODE ***************************/
+  lock_acquire (&inode->rw_lock);
+  /********************** END NEW CODE *************************/
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  /************************ NEW CODE ***************************/
+  lock_release (&inode->rw_lock);
+  /********************** END NEW CODE *************************/
 }
 
 /* Returns the length, in bytes, of INODE's data. */
 off_t
 inode_length (const struct inode *inode)
 {
-  return inode->data.length;
+  // return inode->data.length;
+  /************************ NEW CODE ***************************/
+  return inode->read_length;
+  /********************** END NEW CODE *************************/
 }
 
 /************************ NEW CODE ***************************/
@@ -622,8 +1329,10 @@ inode_is_dir (const struct inode *inode)
 void 
 inode_set_dir (struct inode * inode)
 {
+  inode_lock_exclusive (inode);
   inode->data.is_dir = true;
   cache_write (inode->sector, &inode->data);
+  inode_unlock_exclusive (inode);
 }
 
 /* count for the number of this inode currently being open */
@@ -632,4 +1341,40 @@ inode_open_count (struct inode * inode)
 {
   return inode->open_cnt;
 }
+
+/* Returns the disk sector holding byte offset POS of INODE, or -1 if
+   POS is past the end, for callers using the cache in place. */
+block_sector_t
+inode_sector_at (struct inode *inode, off_t pos)
+{
+  inode_lock_shared (inode);
+  block_sector_t sector = byte_to_sector (inode, pos);
+  inode_unlock_shared (inode);
+  return sector;
+}
+
+/* Returns whether INODE has been removed. */
+bool
+inode_is_removed (struct inode *inode)
+{
+  lock_acquire (&open_inodes_lock);
+  bool removed = inode->removed;
+  lock_release (&open_inodes_lock);
+  return removed;
+}
+
+/* Takes the lock serializing changes to the entries of directory
+   INODE. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the lock taken by inode_lock_dir(). */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
 /********************** END NEW CODE *************************/
\ No newline at end of file
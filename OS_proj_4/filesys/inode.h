@@ -28,5 +28,25 @@ void inode_set_dir (struct inode *);
 
 // count for the number of this inode currently being open
 int inode_open_count (struct inode *);
+
+// the disk sector holding byte offset POS of the inode, -1 past the end
+block_sector_t inode_sector_at (struct inode *, off_t pos);
+
+// whether the inode has been removed
+bool inode_is_removed (struct inode *);
+
+// lock and unlock the entries of a directory inode
+void inode_lock_dir (struct inode *);
+void inode_unlock_dir (struct inode *);
+
+// set the block map layout of new inodes, "extent" or "indirect".
+// Returns false if NAME is unknown
+bool inode_set_format (const char *name);
+
+// give new inodes the layout of the inode at SECTOR
+void inode_adopt_format (block_sector_t sector);
+
+// print the sectors files grew by and how fragmented they came out
+void inode_print_stats (void);
 /********************** END NEW CODE *************************/
 #endif /* filesys/inode.h */
@@ -0,0 +1,22 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache counters since boot, as returned to user programs by
+   the cache_stats system call and printed at power off. */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Lookups found in the cache. */
+    unsigned long long misses;          /* Lookups read in from disk. */
+    unsigned long long clean_evictions; /* Victims dropped as they were. */
+    unsigned long long dirty_evictions; /* Victims written back first. */
+    unsigned long long writes;          /* Sector writes into the cache. */
+    unsigned long long disk_writes;     /* Sectors written to disk. */
+    unsigned long long flushes;         /* Sectors written behind. */
+    unsigned long long flush_batches;   /* Write-behind batches. */
+    unsigned long long read_ahead_hits; /* Prefetched sectors then read. */
+    unsigned long long read_ahead_wasted; /* Prefetched, never read. */
+    unsigned long long lock_waits;      /* Index lock acquires that waited. */
+    unsigned long long lock_wait_cycles; /* TSC cycles spent waiting. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -0,0 +1,16 @@
+#ifndef TESTS_FILESYS_BENCH_BENCH_H
+#define TESTS_FILESYS_BENCH_BENCH_H
+
+#include <stdint.h>
+
+/* Returns the CPU's time-stamp counter.  RDTSC is not privileged
+   in Pintos, so user programs can time themselves with it. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
+#endif /* tests/filesys/bench/bench.h */
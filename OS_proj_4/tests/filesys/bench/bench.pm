@@ -0,0 +1,19 @@
+use strict;
+use warnings;
+use tests::tests;
+
+# Benchmark timings differ between runs, so only check that the
+# run was clean and that benchmark NAME got to its end.
+sub check_bench {
+    my ($name) = @_;
+    our ($test);
+
+    my (@output) = read_text_file ("$test.output");
+    common_checks ("run", @output);
+    @output = get_core_output ("run", @output);
+    fail "\"($name) end\" missing from output\n"
+      if !grep ($_ eq "($name) end", @output);
+    pass;
+}
+
+1;
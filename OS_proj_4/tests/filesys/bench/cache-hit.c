@@ -0,0 +1,71 @@
+/* Measures buffer cache hit latency against the size of the cache.
+   The test runs as cache-hit-N on a kernel booted with -cache=N,
+   and reads working sets of N/8 up to 7N/8 sectors, leaving room
+   for the file system's own sectors.  For each, a file of that many
+   sectors is read once to bring it into the cache, then one byte of
+   every sector is read over and over and the average cost of a read
+   is printed in TSC cycles.  A linear lookup costs more the bigger
+   the cache; an indexed one should stay flat across cache sizes. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define SECTOR_SIZE 512
+#define ROUNDS 32
+
+/* Working set sizes, in eighths of the cache. */
+static const size_t set_eighths[] = {1, 2, 4, 7};
+
+void
+test_main (void) 
+{
+  const char *suffix = strrchr (test_name, '-');
+  size_t cache_size = suffix != NULL ? (size_t) atoi (suffix + 1) : 0;
+  size_t i;
+
+  if (cache_size < 8)
+    fail ("run as cache-hit-N, for a cache of N sectors");
+  msg ("cache of %zu sectors", cache_size);
+  for (i = 0; i < sizeof set_eighths / sizeof *set_eighths; i++)
+    {
+      size_t sectors = cache_size * set_eighths[i] / 8;
+      char file_name[16];
+      uint64_t start, cycles;
+      size_t round, s;
+      int fd;
+      char c;
+
+      snprintf (file_name, sizeof file_name, "hit%zu", sectors);
+      CHECK (create (file_name, sectors * SECTOR_SIZE),
+             "create \"%s\"", file_name);
+      CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+      /* Bring every sector of the file into the cache. */
+      for (s = 0; s < sectors; s++)
+        {
+          seek (fd, s * SECTOR_SIZE);
+          if (read (fd, &c, 1) != 1)
+            fail ("read \"%s\" sector %zu", file_name, s);
+        }
+
+      start = rdtsc ();
+      for (round = 0; round < ROUNDS; round++)
+        for (s = 0; s < sectors; s++)
+          {
+            seek (fd, s * SECTOR_SIZE);
+            read (fd, &c, 1);
+          }
+      cycles = rdtsc () - start;
+      printf ("%zu sectors resident: %llu cycles per hit\n",
+              sectors, cycles / (ROUNDS * sectors));
+
+      msg ("close \"%s\"", file_name);
+      close (fd);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+}
@@ -0,0 +1,111 @@
+/* Mixes a streaming scan with a small hot working set, the way a
+   large file copy runs alongside lookups of hot inodes and
+   directories.  Each round opens and reads every hot file, then
+   streams on through the next STREAM_CHUNK sectors of a file
+   several times the size of the cache.  The average cost of a hot
+   file read is printed in TSC cycles, along with the cache hit rate
+   while reading the hot set and over the whole run.  The test runs
+   once for each replacement policy; a scan-resistant one keeps the
+   hot set in the cache however long the scan goes on. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define SECTOR_SIZE 512
+#define HOT_FILES 8
+#define STREAM_SECTORS 256
+#define STREAM_CHUNK 16
+#define ROUNDS 64
+
+static char buf[SECTOR_SIZE];
+
+/* Returns HITS out of HITS + MISSES lookups as a percentage. */
+static unsigned long long
+hit_rate (unsigned long long hits, unsigned long long misses)
+{
+  return hits + misses > 0 ? hits * 100 / (hits + misses) : 0;
+}
+
+void
+test_main (void) 
+{
+  char file_name[16];
+  struct cache_stats run_start, hot_start, hot_end;
+  unsigned long long hot_hits = 0, hot_misses = 0;
+  uint64_t hot_cycles = 0;
+  size_t stream_pos = 0;
+  int round, i, fd;
+
+  for (i = 0; i < HOT_FILES; i++)
+    {
+      snprintf (file_name, sizeof file_name, "hot%d", i);
+      CHECK (create (file_name, SECTOR_SIZE), "create \"%s\"", file_name);
+    }
+  CHECK (create ("stream", STREAM_SECTORS * SECTOR_SIZE),
+         "create \"stream\"");
+  CHECK ((fd = open ("stream")) > 1, "open \"stream\"");
+
+  for (round = 0; round < ROUNDS; round++)
+    {
+      uint64_t start;
+      int s;
+
+      if (round == 1)
+        cache_stats (&run_start);
+      cache_stats (&hot_start);
+      start = rdtsc ();
+
+      for (i = 0; i < HOT_FILES; i++)
+        {
+          int hot_fd;
+
+          snprintf (file_name, sizeof file_name, "hot%d", i);
+          hot_fd = open (file_name);
+          if (hot_fd < 2)
+            fail ("open \"%s\"", file_name);
+          if (read (hot_fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+            fail ("read \"%s\"", file_name);
+          close (hot_fd);
+        }
+      /* The first round only brings the hot set in. */
+      if (round > 0)
+        {
+          hot_cycles += rdtsc () - start;
+          cache_stats (&hot_end);
+          hot_hits += hot_end.hits - hot_start.hits;
+          hot_misses += hot_end.misses - hot_start.misses;
+        }
+
+      for (s = 0; s < STREAM_CHUNK; s++)
+        {
+          if (stream_pos == STREAM_SECTORS)
+            {
+              stream_pos = 0;
+              seek (fd, 0);
+            }
+          if (read (fd, buf, SECTOR_SIZE) != SECTOR_SIZE)
+            fail ("read \"stream\" sector %zu", stream_pos);
+          stream_pos++;
+        }
+    }
+  printf ("%d hot files, %d-sector scan: %llu cycles per hot file\n",
+          HOT_FILES, STREAM_SECTORS,
+          hot_cycles / ((ROUNDS - 1) * HOT_FILES));
+  cache_stats (&hot_end);
+  printf ("hit rate: %llu%% on the hot set, %llu%% overall\n",
+          hit_rate (hot_hits, hot_misses),
+          hit_rate (hot_end.hits - run_start.hits,
+                    hot_end.misses - run_start.misses));
+
+  msg ("close \"stream\"");
+  close (fd);
+  CHECK (remove ("stream"), "remove \"stream\"");
+  for (i = 0; i < HOT_FILES; i++)
+    {
+      snprintf (file_name, sizeof file_name, "hot%d", i);
+      CHECK (remove (file_name), "remove \"%s\"", file_name);
+    }
+}
@@ -0,0 +1,45 @@
+/* Child process for par-read.
+   Reads the whole test file a sector at a time, starting at a
+   place picked by its child number and wrapping around, and
+   checks every sector. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/filesys/bench/par-read.h"
+
+#define CHUNK_CNT (FILE_SIZE / CHUNK_SIZE)
+
+int
+main (int argc, const char *argv[]) 
+{
+  char buf[CHUNK_SIZE];
+  char expected[CHUNK_SIZE];
+  int child_idx;
+  int fd;
+  size_t i, j;
+
+  test_name = "child-par-read";
+  quiet = true;
+  
+  CHECK (argc == 2, "argc must be 2, actually %d", argc);
+  child_idx = atoi (argv[1]);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < CHUNK_CNT; i++) 
+    {
+      size_t chunk = (i + child_idx * CHUNK_CNT / 8) % CHUNK_CNT;
+
+      seek (fd, chunk * CHUNK_SIZE);
+      CHECK (read (fd, buf, CHUNK_SIZE) == CHUNK_SIZE,
+             "read \"%s\"", file_name);
+      for (j = 0; j < CHUNK_SIZE; j++)
+        expected[j] = chunk;
+      compare_bytes (buf, expected, CHUNK_SIZE, chunk * CHUNK_SIZE,
+                     file_name);
+    }
+  close (fd);
+
+  return child_idx;
+}
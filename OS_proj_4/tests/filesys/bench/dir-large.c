@@ -0,0 +1,59 @@
+/* Creates 10,000 files in one directory, a thousand at a time,
+   printing the average cost of a create in each thousand in TSC
+   cycles, then opens every file and removes every file, printing
+   the average cost of each.  With a linear directory each create
+   scans every entry before it, so the cost climbs with the size of
+   the directory; with an indexed one it stays nearly flat. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define FILE_CNT 10000
+#define BATCH 1000
+
+void
+test_main (void) 
+{
+  char name[16];
+  uint64_t start;
+  size_t i, j;
+  int fd;
+
+  CHECK (mkdir ("big"), "mkdir \"big\"");
+  CHECK (chdir ("big"), "chdir \"big\"");
+
+  for (i = 0; i < FILE_CNT; i += BATCH)
+    {
+      start = rdtsc ();
+      for (j = i; j < i + BATCH; j++)
+        {
+          snprintf (name, sizeof name, "file%zu", j);
+          if (!create (name, 0))
+            fail ("create \"%s\"", name);
+        }
+      printf ("%zu entries: %llu cycles per create\n", i + BATCH,
+              (rdtsc () - start) / BATCH);
+    }
+
+  start = rdtsc ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%zu", i);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\"", name);
+      close (fd);
+    }
+  printf ("open: %llu cycles per file\n", (rdtsc () - start) / FILE_CNT);
+
+  start = rdtsc ();
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "file%zu", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+  printf ("remove: %llu cycles per file\n", (rdtsc () - start) / FILE_CNT);
+}
@@ -0,0 +1,52 @@
+/* Measures raw disk throughput through the file system.  Writes
+   a file much larger than the buffer cache in page-sized chunks,
+   then reads it back, printing the cost of each pass in TSC
+   cycles per kB.  Run with and without the kernel's -dma option
+   to compare bus-master DMA against PIO, or on a RAM disk to see
+   the file system's own costs.  The idle and kernel tick counts
+   printed at power off show how much CPU time each left for
+   other work. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define CHUNK_SIZE 4096
+#define FILE_SIZE (256 * 1024)
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "disk-io";
+  uint64_t start, cycles;
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  memset (buf, 0x5a, sizeof buf);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write \"%s\" at offset %zu", file_name, ofs);
+  cycles = rdtsc () - start;
+  printf ("write: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+
+  seek (fd, 0);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("read \"%s\" at offset %zu", file_name, ofs);
+  cycles = rdtsc () - start;
+  printf ("read: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
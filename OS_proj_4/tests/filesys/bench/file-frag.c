@@ -0,0 +1,85 @@
+/* Grows a file on a disk whose free space is nothing but single
+   sectors, so that every sector of the file is a run of its own,
+   then reads it back and checks every chunk.  The disk is filled
+   with empty files and one filler file, and every other empty file
+   is removed, leaving their inode sectors as the only free ones.
+   The file takes more runs than an extent-mapped inode could map
+   without index blocks for its extent tables.  Prints the cost of
+   each pass in TSC cycles per kB. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define HOLE_FILE_CNT 7000
+#define CHUNK_SIZE 4096
+#define FILE_SIZE (1536 * 1024)
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "file-frag";
+  char name[16];
+  uint64_t start, cycles;
+  size_t i, ofs;
+  int fd;
+
+  CHECK (mkdir ("holes"), "mkdir \"holes\"");
+  for (i = 0; i < HOLE_FILE_CNT; i++)
+    {
+      snprintf (name, sizeof name, "holes/%zu", i);
+      if (!create (name, 0))
+        fail ("create \"%s\"", name);
+    }
+
+  // take the rest of the disk, down to the last sector
+  CHECK (create ("filler", 0), "create \"filler\"");
+  CHECK ((fd = open ("filler")) > 1, "open \"filler\"");
+  while (write (fd, buf, CHUNK_SIZE) == CHUNK_SIZE)
+    continue;
+  while (write (fd, buf, 1) == 1)
+    continue;
+  close (fd);
+
+  for (i = 0; i < HOLE_FILE_CNT; i += 2)
+    {
+      snprintf (name, sizeof name, "holes/%zu", i);
+      if (!remove (name))
+        fail ("remove \"%s\"", name);
+    }
+  msg ("free space left in single sectors");
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      memset (buf, ofs / CHUNK_SIZE, sizeof buf);
+      if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write \"%s\" at offset %zu", file_name, ofs);
+    }
+  cycles = rdtsc () - start;
+  printf ("write: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+
+  seek (fd, 0);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read \"%s\" at offset %zu", file_name, ofs);
+      if (buf[0] != (char) (ofs / CHUNK_SIZE)
+          || buf[CHUNK_SIZE - 1] != (char) (ofs / CHUNK_SIZE))
+        fail ("\"%s\" holds wrong data at offset %zu", file_name, ofs);
+    }
+  cycles = rdtsc () - start;
+  printf ("read: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,58 @@
+/* Grows a file to several MB, past the 2 MB that direct and
+   singly-indirect blocks can map, in page-sized chunks, then
+   reads it back and checks every chunk.  On a freshly formatted
+   disk the file's sectors come out nearly in order, so an
+   extent-mapped inode holds them in a handful of extents.
+   Prints the cost of each pass in TSC cycles per kB. */
+
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+
+#define CHUNK_SIZE 4096
+#define FILE_SIZE (6 * 1024 * 1024)
+
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "file-large";
+  uint64_t start, cycles;
+  size_t ofs;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      memset (buf, ofs / CHUNK_SIZE, sizeof buf);
+      if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("write \"%s\" at offset %zu", file_name, ofs);
+    }
+  cycles = rdtsc () - start;
+  printf ("write: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+  CHECK (filesize (fd) == FILE_SIZE, "filesize \"%s\"", file_name);
+
+  seek (fd, 0);
+  start = rdtsc ();
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    {
+      if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+        fail ("read \"%s\" at offset %zu", file_name, ofs);
+      if (buf[0] != (char) (ofs / CHUNK_SIZE)
+          || buf[CHUNK_SIZE - 1] != (char) (ofs / CHUNK_SIZE))
+        fail ("\"%s\" holds wrong data at offset %zu", file_name, ofs);
+    }
+  cycles = rdtsc () - start;
+  printf ("read: %llu cycles per kB\n", cycles / (FILE_SIZE / 1024));
+
+  msg ("close \"%s\"", file_name);
+  close (fd);
+  CHECK (remove (file_name), "remove \"%s\"", file_name);
+}
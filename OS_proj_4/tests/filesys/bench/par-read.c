@@ -0,0 +1,48 @@
+/* Like syn-read, has several child processes read one file at the
+   same time, but times them: 1, 2, 4 and then 8 readers each read
+   the whole file a sector at a time, each starting at a different
+   place in it, and the cost per kB read over all of them is
+   printed in TSC cycles.  The file is larger than the buffer
+   cache, so readers wait on the disk; when a reader waiting on
+   the disk no longer holds up the others, more readers bring the
+   cost down instead of leaving it flat. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+#include "tests/filesys/bench/par-read.h"
+
+#define CHILD_MAX 8
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  pid_t children[CHILD_MAX];
+  size_t child_cnt, i;
+  int fd;
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  for (i = 0; i < sizeof buf; i++)
+    buf[i] = i / CHUNK_SIZE;
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  for (child_cnt = 1; child_cnt <= CHILD_MAX; child_cnt *= 2)
+    {
+      uint64_t start, cycles;
+
+      start = rdtsc ();
+      exec_children ("child-par-read", children, child_cnt);
+      wait_children (children, child_cnt);
+      cycles = rdtsc () - start;
+      printf ("%zu readers: %llu cycles per kB\n", child_cnt,
+              cycles / (child_cnt * (FILE_SIZE / 1024)));
+    }
+}
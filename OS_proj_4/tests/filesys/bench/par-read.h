@@ -0,0 +1,10 @@
+#ifndef TESTS_FILESYS_BENCH_PAR_READ_H
+#define TESTS_FILESYS_BENCH_PAR_READ_H
+
+/* Twice the sectors the buffer cache holds, so readers keep
+   missing and waiting on the disk. */
+#define FILE_SIZE (64 * 1024)
+#define CHUNK_SIZE 512
+static const char file_name[] = "data";
+
+#endif /* tests/filesys/bench/par-read.h */
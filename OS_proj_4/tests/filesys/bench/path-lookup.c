@@ -0,0 +1,44 @@
+/* Makes the tree of dir-mk-tree, then opens every file in it by
+   its full path, pass after pass, and prints the average cost of
+   an open in each pass in TSC cycles.  Each open resolves four
+   path components; once they are in the dentry cache, later
+   passes resolve them without reading a directory. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+#include "tests/filesys/bench/bench.h"
+#include "tests/filesys/extended/mk-tree.h"
+
+#define PASSES 4
+
+void
+test_main (void) 
+{
+  int pass, a, b, c, d;
+
+  make_tree (4, 3, 3, 4);
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      uint64_t start = rdtsc ();
+      int cnt = 0;
+
+      for (a = 0; a < 4; a++)
+        for (b = 0; b < 3; b++)
+          for (c = 0; c < 3; c++)
+            for (d = 0; d < 4; d++)
+              {
+                char name[128];
+                int fd;
+
+                snprintf (name, sizeof name, "/%d/%d/%d/%d", a, b, c, d);
+                if ((fd = open (name)) < 2)
+                  fail ("open \"%s\"", name);
+                close (fd);
+                cnt++;
+              }
+      printf ("pass %d: %llu cycles per open\n", pass + 1,
+              (rdtsc () - start) / cnt);
+    }
+}
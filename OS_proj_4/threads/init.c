@@ -34,8 +34,11 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
+#include "filesys/cache.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -49,6 +52,9 @@ static bool format_filesys;
    overriding the defaults. */
 static const char *filesys_bdev_name;
 static const char *scratch_bdev_name;
+
+/* -ramdisk: Size of RAM disk "rd0" in sectors, 0 for none. */
+static size_t ramdisk_sectors;
 #ifdef VM
 static const char *swap_bdev_name;
 #endif
@@ -123,6 +129,7 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init (ramdisk_sectors);
   locate_block_devices ();
   filesys_init (format_filesys);
 #endif
@@ -247,6 +254,22 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache"))
+        cache_configure (atoi (value));
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-fs-format"))
+        {
+          if (!inode_set_format (value))
+            PANIC ("unknown inode format `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-dma"))
+        ide_use_dma = true;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_sectors = atoi (value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -373,6 +396,11 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache=SECTORS     Give the buffer cache SECTORS at boot.\n"
+          "  -cache-policy=POL  Replace cache entries by POL: 2q or clock.\n"
+          "  -fs-format=FMT     Format (-f) with FMT inodes: extent or indirect.\n"
+          "  -dma               Use bus-master DMA for IDE disks if possible.\n"
+          "  -ramdisk=SECTORS   Create RAM disk rd0 of SECTORS sectors.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
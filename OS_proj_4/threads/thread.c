@@ -497,6 +497,7 @@ init_thread (struct thread *t, const char *name, int priority)
   list_init(&t->files);
   t->self_file = NULL;
   t->pwd = NULL;
+  t->sleep_ticks = -1;
   /********************** END NEW CODE *************************/
   t->magic = THREAD_MAGIC;
 
@@ -686,4 +687,17 @@ search_fd(struct list * files, int fd, bool close_f)
     }
   return NULL;
 }
+
+/* Check whether thread t has slept in timer_sleep() until the tick
+   *TICKS. If so, unblock thread t */
+void
+check_thread_sleep (struct thread *t, void *ticks)
+{
+  if (t->status == THREAD_BLOCKED && t->sleep_ticks > 0
+      && *(int64_t *) ticks >= t->sleep_ticks)
+    {
+      t->sleep_ticks = -1;
+      thread_unblock (t);
+    }
+}
 /********************** END NEW CODE *************************/
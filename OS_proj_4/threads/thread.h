@@ -131,6 +131,9 @@ struct thread
 
     // current directory
     struct dir *pwd;
+
+    // the timer tick to wake up at while blocked in timer_sleep(), or -1
+    int64_t sleep_ticks;
     /********************** END NEW CODE *************************/
 
 #ifdef USERPROG
@@ -196,6 +199,9 @@ struct file_node
 // used to search a file node accoding to the fd
 struct file_node * search_fd(struct list *, int, bool);
 
+// wake T up if it's sleeping in timer_sleep() and the tick *TICKS is due
+void check_thread_sleep (struct thread *t, void *ticks);
+
 /********************** END NEW CODE *************************/
 
 #endif /* threads/thread.h */
@@ -11,6 +11,7 @@
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/cache.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
@@ -522,6 +523,11 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
+      /************************ NEW CODE ***************************/
+      // out of user memory: take a page back from the buffer cache
+      if (kpage == NULL && cache_shrink ())
+        kpage = palloc_get_page (PAL_USER);
+      /********************** END NEW CODE *************************/
       if (kpage == NULL)
         return false;
 
@@ -557,6 +563,11 @@ setup_stack (void **esp, char *file_name)
   bool success = false;
 
   kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  /************************ NEW CODE ***************************/
+  // out of user memory: take a page back from the buffer cache
+  if (kpage == NULL && cache_shrink ())
+    kpage = palloc_get_page (PAL_USER | PAL_ZERO);
+  /********************** END NEW CODE *************************/
   if (kpage != NULL) 
     {
       success = install_page (((uint8_t *) PHYS_BASE) - PGSIZE, kpage, true);
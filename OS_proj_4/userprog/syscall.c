@@ -7,6 +7,7 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
+#include "filesys/cache.h"
 
  /************************ NEW CODE ***************************/
 #include "threads/vaddr.h"
@@ -39,18 +40,14 @@ bool mkdir1 (const char *dir);
 bool readdir1 (int fd, char *name);
 bool isdir1 (int fd);
 int inumber1 (int fd);
+bool cache_stats1 (struct cache_stats *stats);
 #endif
 
-// when we do operations on the file, acquire the lock to 
-// ensure synchronization
-struct lock file_lock;
-
  /********************* END NEW CODE *************************/
 
 void
 syscall_init (void) 
 {
-  lock_init (&file_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -129,9 +126,7 @@ syscall_handler (struct intr_frame *f UNUSED)
         if (*p == '\0')
           break;
       }
-      lock_acquire (&file_lock);
       f->eax = create1(file, initial_size);
-      lock_release (&file_lock);
       break;
     }
 
@@ -147,9 +142,7 @@ syscall_handler (struct intr_frame *f UNUSED)
         if (*p == '\0')
           break;
       }
-      lock_acquire (&file_lock);
       f->eax = remove1(file);
-      lock_release (&file_lock);
       break;
     }
 
@@ -215,9 +208,7 @@ syscall_handler (struct intr_frame *f UNUSED)
           || !pagedir_get_page (cur->pagedir, buffer+i))
           exit_wrong(-1);
       }
-      lock_acquire (&file_lock);
       f->eax = write1(fd, buffer, size);
-      lock_release (&file_lock);
       break;
     }
 
@@ -228,9 +219,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     {
       int fd = *((int*)f->esp + 1);
       unsigned position = *((unsigned*)f->esp + 2);
-      lock_acquire (&file_lock);
       seek1(fd, position);
-      lock_release (&file_lock);
       break;
     }
     
@@ -239,9 +228,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_TELL:
     {
       int fd = *((int*)f->esp + 1);
-      lock_acquire (&file_lock);
       f->eax = tell1(fd);
-      lock_release (&file_lock);
       break;
     }
 
@@ -251,9 +238,7 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_CLOSE:
     {
       int fd = *((int*)f->esp + 1);
-      lock_acquire (&file_lock);
       close1(fd);
-      lock_release (&file_lock);
       break;
     }
 
@@ -333,6 +318,23 @@ syscall_handler (struct intr_frame *f UNUSED)
       break;
     }
 
+    /* Copies the buffer cache counters into stats, so that programs
+       can sample them as they run. Returns true. */
+    case SYS_CACHE_STATS:
+    {
+      struct cache_stats *stats = (void*)(*((int*)f->esp + 1));
+
+      // check for the validity of each address of stats
+      for (unsigned i=0; i<sizeof *stats; i++)
+      {
+        if(!is_user_vaddr ((char*)stats+i) 
+          || !pagedir_get_page (cur->pagedir, (char*)stats+i))
+          exit_wrong(-1);
+      }
+      f->eax = cache_stats1(stats);
+      break;
+    }
+
 #endif
 
     default:
@@ -403,9 +405,7 @@ bool remove1 (const char *file){
 }
 
 int open1 (const char *file){
-  lock_acquire (&file_lock);
   struct file* fptr = filesys_open(file);
-  lock_release (&file_lock);
   if (fptr == NULL)
     return -1;
   else
@@ -427,12 +427,7 @@ int open1 (const char *file){
 int filesize1 (int fd){
   struct file_node* f_node = search_fd(&thread_current()->files, fd, false);
   if(f_node != NULL)
-  {
-    lock_acquire (&file_lock);
-    int result = file_length(f_node->file_ptr);
-    lock_release (&file_lock);
-    return result;
-  }
+    return file_length(f_node->file_ptr);
   else
     return -1;
 }
@@ -451,12 +446,7 @@ int read1 (int fd, void *buffer, unsigned size){
   {
     struct file_node* f_node = search_fd(&thread_current()->files, fd, false);
     if(f_node != NULL)
-      {
-        lock_acquire (&file_lock);
-        int result = file_read (f_node->file_ptr, buffer, size);
-        lock_release (&file_lock);
-        return result;
-      }
+      return file_read (f_node->file_ptr, buffer, size);
   }
   return -1;
 }
@@ -503,37 +493,27 @@ void close1 (int fd){
 
 #ifdef FILESYS
 bool chdir1 (const char *dir){
-  lock_acquire (&file_lock);
-  bool ret = filesys_chdir (dir);
-  lock_release (&file_lock);
-  return ret;
+  return filesys_chdir (dir);
 }
 
 bool mkdir1 (const char *dir){
-  lock_acquire (&file_lock);
-  bool ret = filesys_mkdir (dir);
-  lock_release (&file_lock);
-  return ret;
+  return filesys_mkdir (dir);
 }
 
 bool readdir1 (int fd, char *name){
-  lock_acquire (&file_lock);
-  bool ret = filesys_readdir (fd, name);
-  lock_release (&file_lock);
-  return ret;
+  return filesys_readdir (fd, name);
 }
 
 bool isdir1 (int fd){
-  lock_acquire (&file_lock);
-  bool ret = filesys_isdir (fd);
-  lock_release (&file_lock);
-  return ret;
+  return filesys_isdir (fd);
 }
 
 int inumber1 (int fd){
-  lock_acquire (&file_lock);
-  int ret = filesys_inumber (fd);
-  lock_release (&file_lock);
-  return ret;
+  return filesys_inumber (fd);
+}
+
+bool cache_stats1 (struct cache_stats *stats){
+  cache_get_stats (stats);
+  return true;
 }
 #endif
\ No newline at end of file